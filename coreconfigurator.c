@@ -229,10 +229,12 @@ static u8 get_current_channel_802_11n(u8 *msa, u16 rx_len)
 	return 0;
 }
 
-s32 wilc_parse_network_info(struct wilc_vif *vif, u8 *msg_buffer,
-			    struct network_info **ret_network_info)
+/* Parse an 'N' message into network_info without allocating: ies points
+ * into msg_buffer, which has to outlive network_info.
+ */
+s32 wilc_fill_network_info(struct wilc_vif *vif, u8 *msg_buffer,
+			   struct network_info *network_info)
 {
-	struct network_info *network_info = NULL;
 	u8 msg_type = 0;
 	u16 wid_len  = 0;
 	u8 *wid_val = NULL;
@@ -253,10 +255,7 @@ s32 wilc_parse_network_info(struct wilc_vif *vif, u8 *msg_buffer,
 	wid_len = MAKE_WORD16(msg_buffer[6], msg_buffer[7]);
 	wid_val = &msg_buffer[8];
 
-	network_info = kzalloc(sizeof(*network_info), GFP_KERNEL);
-	if (!network_info)
-		return -ENOMEM;
-
+	memset(network_info, 0, sizeof(*network_info));
 	network_info->rssi = wid_val[0];
 
 	msa = &wid_val[1];
@@ -289,18 +288,43 @@ s32 wilc_parse_network_info(struct wilc_vif *vif, u8 *msg_buffer,
 	ies = &msa[TAG_PARAM_OFFSET];
 	ies_len = rx_len - TAG_PARAM_OFFSET;
 
-	if (ies_len > 0) {
-		network_info->ies = kmemdup(ies, ies_len, GFP_KERNEL);
+	if (ies_len > 0)
+		network_info->ies = ies;
+	network_info->ies_len = ies_len;
+
+	return 0;
+}
+
+s32 wilc_parse_network_info(struct wilc_vif *vif, u8 *msg_buffer,
+			    struct network_info **ret_network_info)
+{
+	struct network_info *network_info;
+	s32 ret;
+
+	network_info = kmalloc(sizeof(*network_info), GFP_KERNEL);
+	if (!network_info)
+		return -ENOMEM;
+
+	ret = wilc_fill_network_info(vif, msg_buffer, network_info);
+	if (ret)
+		goto fail;
+
+	if (network_info->ies) {
+		network_info->ies = kmemdup(network_info->ies,
+					    network_info->ies_len, GFP_KERNEL);
 		if (!network_info->ies) {
-			kfree(network_info);
-			return -ENOMEM;
+			ret = -ENOMEM;
+			goto fail;
 		}
 	}
-	network_info->ies_len = ies_len;
 
 	*ret_network_info = network_info;
 
 	return 0;
+
+fail:
+	kfree(network_info);
+	return ret;
 }
 
 s32 wilc_parse_assoc_resp_info(u8 *buffer, u32 buffer_len,
@@ -51,15 +51,15 @@
 #define HOST_IF_MSG_SET_ANTENNA_MODE		40
 #define HOST_IF_MSG_SEND_BUFFERED_EAP		41
 #define HOST_IF_MSG_SET_WOWLAN_TRIGGER 		43
+#define HOST_IF_MSG_RCVD_NTWRK_BATCH		44
 #define HOST_IF_MSG_EXIT                        100
 
 #define HOST_IF_SCAN_TIMEOUT                    4000
 #define HOST_IF_CONNECT_TIMEOUT                 9500
+#define NET_INFO_ARENA_SIZE			8192
 
 #define FALSE_FRMWR_CHANNEL			100
 
-#define TCP_ACK_FILTER_LINK_SPEED_THRESH	54
-#define DEFAULT_LINK_SPEED			72
 
 /* Generic success will return 0 */
 #define WILC_SUCCESS 		0	/* Generic success */
@@ -1380,36 +1380,21 @@ static s32 handle_connect_timeout(struct wilc_vif *vif)
 	return result;
 }
 
-static s32 handle_rcvd_ntwrk_info(struct wilc_vif *vif,
-				  struct rcvd_net_info *rcvd_info)
+static void handle_net_info(struct wilc_vif *vif, struct network_info *info)
 {
 	u32 i;
 	bool found;
-	s32 result = 0;
-	struct network_info *info = NULL;
 	void *params = NULL;
 	struct host_if_drv *hif_drv = vif->hif_drv;
 	struct user_scan_req *scan_req = &hif_drv->usr_scan_req;
 
 	found = true;
-	PRINT_D(vif->ndev, HOSTINF_DBG, "Handling received network info\n");
-
-	if (!scan_req->scan_result)
-		goto done;
-
-	PRINT_INFO(vif->ndev, HOSTINF_DBG, "State: Scanning, parsing network information received\n");
-	wilc_parse_network_info(vif, rcvd_info->buffer, &info);
-	if (!info || !scan_req->scan_result) {
-		PRINT_ER(vif->ndev, "driver is null\n");
-		result = -EINVAL;
-		goto done;
-	}
 
 	for (i = 0; i < scan_req->rcvd_ch_cnt; i++) {
 		if (memcmp(scan_req->net_info[i].bssid, info->bssid, 6) == 0) {
 			if (info->rssi <= scan_req->net_info[i].rssi) {
 				PRINT_INFO(vif->ndev, HOSTINF_DBG, "Network previously discovered\n");
-				goto done;
+				return;
 			} else {
 				scan_req->net_info[i].rssi = info->rssi;
 				found = false;
@@ -1441,6 +1426,29 @@ static s32 handle_rcvd_ntwrk_info(struct wilc_vif *vif,
 		scan_req->scan_result(SCAN_EVENT_NETWORK_FOUND, info,
 				      scan_req->arg, NULL);
 	}
+}
+
+static s32 handle_rcvd_ntwrk_info(struct wilc_vif *vif,
+				  struct rcvd_net_info *rcvd_info)
+{
+	s32 result = 0;
+	struct network_info *info = NULL;
+	struct user_scan_req *scan_req = &vif->hif_drv->usr_scan_req;
+
+	PRINT_D(vif->ndev, HOSTINF_DBG, "Handling received network info\n");
+
+	if (!scan_req->scan_result)
+		goto done;
+
+	PRINT_INFO(vif->ndev, HOSTINF_DBG, "State: Scanning, parsing network information received\n");
+	wilc_parse_network_info(vif, rcvd_info->buffer, &info);
+	if (!info || !scan_req->scan_result) {
+		PRINT_ER(vif->ndev, "driver is null\n");
+		result = -EINVAL;
+		goto done;
+	}
+
+	handle_net_info(vif, info);
 
 done:
 	kfree(rcvd_info->buffer);
@@ -1454,6 +1462,40 @@ done:
 	return result;
 }
 
+/* Handle every network-info message collected in the arena since the last
+ * batch. Each is parsed in place, so nothing is allocated per beacon.
+ */
+static void handle_rcvd_ntwrk_batch(struct wilc_vif *vif)
+{
+	struct host_if_drv *hif_drv = vif->hif_drv;
+	struct user_scan_req *scan_req = &hif_drv->usr_scan_req;
+	struct network_info info;
+	u8 idx, *arena;
+	u32 off, len;
+
+	spin_lock_bh(&hif_drv->net_info_lock);
+	idx = hif_drv->net_info_fill;
+	hif_drv->net_info_fill ^= 1;
+	hif_drv->net_info_queued = false;
+	arena = hif_drv->net_info_arena[idx];
+	spin_unlock_bh(&hif_drv->net_info_lock);
+
+	if (!arena)
+		return;
+	vif->wilc->net_info_batches++;
+	for (off = 0; off < hif_drv->net_info_len[idx];
+	     off += sizeof(u32) + ALIGN(len, 4)) {
+		memcpy(&len, &arena[off], sizeof(u32));
+		if (!scan_req->scan_result)
+			continue;
+		if (wilc_fill_network_info(vif, &arena[off + sizeof(u32)],
+					   &info))
+			continue;
+		handle_net_info(vif, &info);
+	}
+	hif_drv->net_info_len[idx] = 0;
+}
+
 static s32 host_int_get_assoc_res_info(struct wilc_vif *vif,
 				       u8 *assoc_resp_info,
 				       u32 max_assoc_resp_info_len,
@@ -2168,14 +2210,6 @@ static s32 handle_get_statistics(struct wilc_vif *vif,
 	if (result)
 		PRINT_ER(vif->ndev, "Failed to send scan parameters\n");
 
-	if (stats->link_speed > TCP_ACK_FILTER_LINK_SPEED_THRESH &&
-	    stats->link_speed != DEFAULT_LINK_SPEED) {
-		PRINT_INFO(vif->ndev, HOSTINF_DBG, "Enable TCP filter\n");
-		wilc_enable_tcp_ack_filter(true);
-	} else if (stats->link_speed != DEFAULT_LINK_SPEED) {
-		PRINT_INFO(vif->ndev, HOSTINF_DBG, "Disable TCP filter %d\n",stats->link_speed);
-		wilc_enable_tcp_ack_filter(false);
-	}
 	if (stats != &vif->wilc->dummy_statistics)
 		complete(&hif_wait_response);
 	return 0;
@@ -2858,6 +2892,10 @@ static void host_if_work(struct work_struct *work)
 		handle_rcvd_ntwrk_info(msg->vif, &msg->body.net_info);
 		break;
 
+	case HOST_IF_MSG_RCVD_NTWRK_BATCH:
+		handle_rcvd_ntwrk_batch(msg->vif);
+		break;
+
 	case HOST_IF_MSG_RCVD_GNRL_ASYNC_INFO:
 		handle_rcvd_gnrl_async_info(msg->vif,
 					    &msg->body.async_info);
@@ -3831,6 +3869,11 @@ int wilc_init(struct net_device *dev, struct host_if_drv **hif_drv_handler)
 	init_completion(&hif_drv->comp_get_rssi);
 	init_completion(&hif_drv->comp_inactive_time);
 
+	spin_lock_init(&hif_drv->net_info_lock);
+	for (i = 0; i < 2; i++)
+		hif_drv->net_info_arena[i] = kmalloc(NET_INFO_ARENA_SIZE,
+						     GFP_KERNEL);
+
 	PRINT_INFO(vif->ndev, HOSTINF_DBG, "INIT: CLIENT COUNT %d\n", 
 				clients_count);
 	if (clients_count == 0) {
@@ -3888,6 +3931,7 @@ int wilc_deinit(struct wilc_vif *vif)
 	int result = 0;
 	struct host_if_msg msg;
 	struct host_if_drv *hif_drv = vif->hif_drv;
+	u8 *arena[2];
 
 	if (!hif_drv)	{
 		PRINT_ER(vif->ndev, "hif_drv = NULL\n");
@@ -3934,8 +3978,19 @@ int wilc_deinit(struct wilc_vif *vif)
 		flush_workqueue(hif_workqueue);
 		destroy_workqueue(hif_workqueue);
 		hif_workqueue = NULL;
+	} else {
+		/* Let a network-info batch queued for this vif finish first */
+		flush_workqueue(hif_workqueue);
 	}
 
+	spin_lock_bh(&hif_drv->net_info_lock);
+	arena[0] = hif_drv->net_info_arena[0];
+	arena[1] = hif_drv->net_info_arena[1];
+	hif_drv->net_info_arena[0] = NULL;
+	hif_drv->net_info_arena[1] = NULL;
+	spin_unlock_bh(&hif_drv->net_info_lock);
+	kfree(arena[0]);
+	kfree(arena[1]);
 	kfree(hif_drv);
 
 	clients_count--;
@@ -3951,6 +4006,9 @@ void wilc_network_info_received(struct wilc *wilc, u8 *buffer, u32 length)
 	int id;
 	struct host_if_drv *hif_drv = NULL;
 	struct wilc_vif *vif;
+	bool batched, queue = false;
+	u8 *arena;
+	int i;
 
 	id = buffer[length - 4];
 	id |= (buffer[length - 3] << 8);
@@ -3967,10 +4025,44 @@ void wilc_network_info_received(struct wilc *wilc, u8 *buffer, u32 length)
 	}
 
 	memset(&msg, 0, sizeof(struct host_if_msg));
-
-	msg.id = HOST_IF_MSG_RCVD_NTWRK_INFO;
 	msg.vif = vif;
 
+	/* Append to the arena being filled; only the first message since
+	 * the last batch queues a work item.
+	 */
+	spin_lock_bh(&hif_drv->net_info_lock);
+	i = hif_drv->net_info_fill;
+	batched = hif_drv->net_info_arena[i] &&
+		  hif_drv->net_info_len[i] + sizeof(u32) + ALIGN(length, 4) <=
+		  NET_INFO_ARENA_SIZE;
+	if (batched) {
+		arena = hif_drv->net_info_arena[i] + hif_drv->net_info_len[i];
+		memcpy(arena, &length, sizeof(u32));
+		memcpy(arena + sizeof(u32), buffer, length);
+		hif_drv->net_info_len[i] += sizeof(u32) + ALIGN(length, 4);
+		queue = !hif_drv->net_info_queued;
+		hif_drv->net_info_queued = true;
+	}
+	spin_unlock_bh(&hif_drv->net_info_lock);
+
+	if (batched) {
+		wilc->net_info_msgs++;
+		if (!queue)
+			return;
+		msg.id = HOST_IF_MSG_RCVD_NTWRK_BATCH;
+		result = wilc_enqueue_cmd(&msg);
+		if (result) {
+			PRINT_ER(vif->ndev, "message parameters (%d)\n", result);
+			spin_lock_bh(&hif_drv->net_info_lock);
+			hif_drv->net_info_queued = false;
+			spin_unlock_bh(&hif_drv->net_info_lock);
+		}
+		return;
+	}
+
+	/* Arena full: fall back to a message of its own */
+	wilc->net_info_unbatched++;
+	msg.id = HOST_IF_MSG_RCVD_NTWRK_INFO;
 	msg.body.net_info.len = length;
 	msg.body.net_info.buffer = kmemdup(buffer, length, GFP_KERNEL);
 	if (!msg.body.net_info.buffer)
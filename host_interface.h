@@ -290,6 +290,15 @@ struct host_if_drv {
 
 	bool IFC_UP;
 	int driver_handler_id;
+
+	/* network-info messages collected while scanning; one is filled
+	 * while the other is handled by a single HOST_IF_MSG_RCVD_NTWRK_BATCH
+	 */
+	spinlock_t net_info_lock;
+	u8 *net_info_arena[2];
+	u32 net_info_len[2];
+	u8 net_info_fill;
+	bool net_info_queued;
 };
 
 struct add_sta_param {
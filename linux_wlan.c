@@ -10,6 +10,7 @@
 #include <linux/workqueue.h>
 #include <linux/interrupt.h>
 #include <linux/irq.h>
+#include <linux/hrtimer.h>
 #include <linux/gpio.h>
 
 #include <linux/kthread.h>
@@ -21,6 +22,10 @@
 #include <linux/inetdevice.h>
 #endif /* DISABLE_PWRSAVE_AND_SCAN_DURING_IP */
 #include <linux/etherdevice.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/jhash.h>
+#include <net/ip.h>
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/skbuff.h>
@@ -399,6 +404,65 @@ static irqreturn_t isr_uh_routine(int irq, void *user_data)
 	return IRQ_WAKE_THREAD;
 }
 
+/* Interrupt rate at which the IRQ thread stops taking one interrupt per
+ * RX burst and polls the chip on a timer instead, and the poll interval.
+ */
+static unsigned int irq_poll_rate = 4000;
+module_param(irq_poll_rate, uint, 0644);
+MODULE_PARM_DESC(irq_poll_rate, "IRQs per second before RX switches to polling (0 = never poll)");
+
+static unsigned int irq_poll_us = 250;
+module_param(irq_poll_us, uint, 0644);
+MODULE_PARM_DESC(irq_poll_us, "Interval between RX polls in polling mode");
+
+#define IRQ_RATE_WINDOW_MS	10
+#define IRQ_POLL_MIN_US		50
+/* Empty polls in a row before going back to interrupts */
+#define IRQ_POLL_IDLE		8
+
+static bool wilc_irq_rate_high(struct wilc *wilc)
+{
+	ktime_t now = ktime_get();
+
+	if (!irq_poll_rate)
+		return false;
+
+	if (ktime_ms_delta(now, wilc->irq_win_start) >= IRQ_RATE_WINDOW_MS) {
+		wilc->irq_win_start = now;
+		wilc->irq_win_count = 0;
+	}
+	wilc->irq_win_count++;
+
+	return wilc->irq_win_count * (MSEC_PER_SEC / IRQ_RATE_WINDOW_MS) >=
+	       irq_poll_rate;
+}
+
+/* Runs in the IRQ thread, so the oneshot IRQ line stays masked until the
+ * chip has been idle for a few polls and this returns.
+ */
+static void wilc_irq_poll(struct wilc *wilc)
+{
+	u32 poll_us = max_t(u32, irq_poll_us, IRQ_POLL_MIN_US);
+	ktime_t expires;
+	int idle = 0;
+
+	wilc->irq_poll_enter++;
+	wilc->irq_polling = true;
+	while (!wilc->close && idle < IRQ_POLL_IDLE) {
+		expires = ktime_set(0, poll_us * NSEC_PER_USEC);
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout_range(&expires, poll_us * NSEC_PER_USEC / 4,
+					 HRTIMER_MODE_REL);
+		if (wilc_poll_isr(wilc))
+			idle = 0;
+		else
+			idle++;
+	}
+	wilc->irq_polling = false;
+	wilc->irq_poll_exit++;
+	wilc->irq_win_count = 0;
+}
+
 static irqreturn_t isr_bh_routine(int irq, void *userdata)
 {
 	struct wilc *wilc;
@@ -415,6 +479,11 @@ static irqreturn_t isr_bh_routine(int irq, void *userdata)
 	PRINT_INFO(dev, INT_DBG, "Interrupt received BH\n");
 	wilc_handle_isr(wilc);
 
+	if (wilc_irq_rate_high(wilc)) {
+		PRINT_INFO(dev, INT_DBG, "Switching to RX polling\n");
+		wilc_irq_poll(wilc);
+	}
+
 	return IRQ_HANDLED;
 }
 
@@ -553,58 +622,76 @@ void eap_buff_timeout(unsigned long user)
 
 static struct net_device *get_if_handler(struct wilc *wilc, u8 *mac_header)
 {
-	u8 *bssid, *bssid1;
-	int i = 0;
+	struct wilc_rx_map *map = &wilc->rx_map;
+	struct net_device *ndev;
+	unsigned int seq;
+	int i;
+
+	do {
+		seq = read_seqbegin(&wilc->rx_map_lock);
+		ndev = NULL;
+		/* The firmware only passes up data for connected interfaces */
+		if (map->num == 1) {
+			ndev = map->entry[0].ndev;
+			continue;
+		}
+		for (i = 0; i < map->num; i++) {
+			if (ether_addr_equal_unaligned(mac_header +
+						       map->entry[i].offset,
+						       map->entry[i].bssid)) {
+				ndev = map->entry[i].ndev;
+				break;
+			}
+		}
+	} while (read_seqretry(&wilc->rx_map_lock, seq));
+
+	if (!ndev)
+		PRINT_WRN(wilc->vif[0]->ndev, GENERIC_DBG, "Invalid handle\n");
+	return ndev;
+}
+
+void wilc_rx_map_update(struct wilc *wilc)
+{
+	struct wilc_rx_map *map = &wilc->rx_map;
+	struct wilc_rx_map_entry *e;
+	struct wilc_vif *vif;
+	unsigned long flags;
+	int i;
 
-	bssid = mac_header + 10;
-	bssid1 = mac_header + 4;
+	write_seqlock_irqsave(&wilc->rx_map_lock, flags);
+	map->num = 0;
+	map->conn = 0;
 	for (i = 0; i <= wilc->vif_num; i++) {
-		if (wilc->vif[i]->iftype == STATION_MODE)
-			if (ether_addr_equal_unaligned(bssid,
-						       wilc->vif[i]->bssid))
-				return wilc->vif[i]->ndev;
-		if (wilc->vif[i]->iftype == AP_MODE)
-			if (ether_addr_equal_unaligned(bssid1,
-						       wilc->vif[i]->bssid))
-				return wilc->vif[i]->ndev;
-	}
-
-	PRINT_WRN(wilc->vif[0]->ndev, GENERIC_DBG, "Invalid handle\n");
-	return NULL;
+		vif = wilc->vif[i];
+		if (is_zero_ether_addr(vif->bssid))
+			continue;
+		map->conn++;
+		if (vif->iftype != STATION_MODE && vif->iftype != AP_MODE)
+			continue;
+		e = &map->entry[map->num++];
+		ether_addr_copy(e->bssid, vif->bssid);
+		e->offset = vif->iftype == STATION_MODE ? 10 : 4;
+		e->ndev = vif->ndev;
+	}
+	write_sequnlock_irqrestore(&wilc->rx_map_lock, flags);
 }
 
 int wilc_wlan_set_bssid(struct net_device *wilc_netdev, u8 *bssid, u8 mode)
 {
 	struct wilc_vif *vif = netdev_priv(wilc_netdev);
-	struct wilc *wilc;
-	u8 i = 0;
-
-	wilc = vif->wilc;
 
 	PRINT_INFO(vif->ndev, GENERIC_DBG, "set bssid on[%p]\n", wilc_netdev);
-	for (i = 0; i <= wilc->vif_num; i++){
-		if (wilc_netdev == wilc->vif[i]->ndev) {
-			PRINT_INFO(vif->ndev, GENERIC_DBG,
-				   "set bssid [%x][%x][%x]\n", bssid[0],
-				   bssid[1], bssid[2]);
-			memcpy(wilc->vif[i]->bssid, bssid, 6);
-			wilc->vif[i]->iftype = mode;
-		}
-	}
+	PRINT_INFO(vif->ndev, GENERIC_DBG, "set bssid [%x][%x][%x]\n",
+		   bssid[0], bssid[1], bssid[2]);
+	memcpy(vif->bssid, bssid, 6);
+	vif->iftype = mode;
+	wilc_rx_map_update(vif->wilc);
 	return 0;
 }
 
 int wilc_wlan_get_num_conn_ifcs(struct wilc *wilc)
 {
-	u8 i = 0;
-	u8 null_bssid[6] = {0};
-	u8 ret_val = 0;
-
-	for (i = 0; i <= wilc->vif_num; i++)
-		if (memcmp(wilc->vif[i]->bssid, null_bssid, 6))
-			ret_val++;
-
-	return ret_val;
+	return READ_ONCE(wilc->rx_map.conn);
 }
 
 struct net_device* wilc_get_if_netdev(struct wilc *wilc, uint8_t ifc)
@@ -617,11 +704,13 @@ struct host_if_drv * wilc_get_drv_handler_by_ifc(struct wilc *wilc, uint8_t ifc)
 	return wilc->vif[ifc]->hif_drv;
 }
 
-#define TX_BACKOFF_WEIGHT_INCR_STEP (1)
-#define TX_BACKOFF_WEIGHT_DECR_STEP (1)
-#define TX_BACKOFF_WEIGHT_MAX (0)
-#define TX_BACKOFF_WEIGHT_MIN (0)
-#define TX_BACKOFF_WEIGHT_UNIT_MS (1)
+/* Wait after the firmware ran out of TX buffers. Doubles on each refusal
+ * in a row and drops back to the minimum after the first accepted batch.
+ */
+#define TX_BACKOFF_MIN_US	250
+#define TX_BACKOFF_MAX_US	8000
+/* VMM batches the TX thread sends before yielding the CPU */
+#define TXQ_PASS_BUDGET		16
 
 
 static int linux_wlan_txq_task(void *vp)
@@ -631,8 +720,9 @@ static int linux_wlan_txq_task(void *vp)
 	struct wilc_vif *vif;
 	struct wilc *wl;
 	struct net_device *dev = vp;
-	int backoff_weight = TX_BACKOFF_WEIGHT_MIN;
-	signed long timeout;
+	u32 backoff_us = TX_BACKOFF_MIN_US;
+	ktime_t start, attempt, expires;
+	int budget;
 
 	vif = netdev_priv(dev);
 	wl = vif->wilc;
@@ -640,7 +730,12 @@ static int linux_wlan_txq_task(void *vp)
 	complete(&wl->txq_thread_started);
 	while (1) {
 		PRINT_INFO(vif->ndev, TX_DBG, "txq_task Taking a nap\n");
-		wait_for_completion(&wl->txq_event);
+		start = ktime_get();
+		wait_event_interruptible(wl->txq_wq,
+					 test_bit(WILC_TXQ_WORK, &wl->txq_flags) ||
+					 wl->close);
+		wl->txq_idle_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		wl->txq_wakeups++;
 		PRINT_INFO(vif->ndev, TX_DBG, "txq_task Who waked me up\n");
 		if (wl->close) {
 			complete(&wl->txq_thread_started);
@@ -651,9 +746,17 @@ static int linux_wlan_txq_task(void *vp)
 			break;
 		}
 		PRINT_INFO(vif->ndev, TX_DBG, "txq_task handle the sending packet and let me go to sleep.\n");
+		start = ktime_get();
+		/* Frames queued from here on flag new work and get picked up
+		 * either by this pass or by the next one.
+		 */
+		clear_bit(WILC_TXQ_WORK, &wl->txq_flags);
+		smp_mb__after_atomic();
+		budget = TXQ_PASS_BUDGET;
 		do {
+			attempt = ktime_get();
 			ret = wilc_wlan_handle_txq(dev, &txq_count);
-			if (txq_count < FLOW_CONTROL_LOWER_THRESHOLD) {
+			if (txq_count < wl->fc_lower) {
 				PRINT_INFO(vif->ndev, TX_DBG, "Waking up queue\n");
 				if (netif_queue_stopped(wl->vif[0]->ndev))
 					netif_wake_queue(wl->vif[0]->ndev);
@@ -662,25 +765,38 @@ static int linux_wlan_txq_task(void *vp)
 			}
 
 			if (ret == WILC_TX_ERR_NO_BUF) {
-				timeout = msecs_to_jiffies(TX_BACKOFF_WEIGHT_UNIT_MS << backoff_weight);
-				do {
-					/* Back off from sending packets for some time. */
-					/* schedule_timeout will allow RX task to run and free buffers.*/
-					/*Setting state to TASK_INTERRUPTIBLE will put the thread back to CPU*/
-					/*running queue when it's signaled even if 'timeout' isn't elapsed.*/
-					/*This gives faster chance for reserved SK buffers to be freed*/
-					set_current_state(TASK_INTERRUPTIBLE);
-					timeout = schedule_timeout(timeout);
-					} while(/*timeout*/0);
-				backoff_weight += TX_BACKOFF_WEIGHT_INCR_STEP;
-				if (backoff_weight > TX_BACKOFF_WEIGHT_MAX)
-					backoff_weight = TX_BACKOFF_WEIGHT_MAX;
-			} else if (backoff_weight > TX_BACKOFF_WEIGHT_MIN) {
-				backoff_weight -= TX_BACKOFF_WEIGHT_DECR_STEP;
-				if (backoff_weight < TX_BACKOFF_WEIGHT_MIN)
-					backoff_weight = TX_BACKOFF_WEIGHT_MIN;
+				wl->tx_nobuf++;
+				wl->tx_nobuf_ns += ktime_to_ns(ktime_sub(ktime_get(),
+									 attempt));
+
+				/* Give the firmware time to free buffers instead
+				 * of asking again right away. RX keeps running
+				 * meanwhile.
+				 */
+				expires = ktime_set(0, backoff_us * NSEC_PER_USEC);
+				attempt = ktime_get();
+				set_current_state(TASK_INTERRUPTIBLE);
+				schedule_hrtimeout_range(&expires,
+							 backoff_us * NSEC_PER_USEC / 4,
+							 HRTIMER_MODE_REL);
+				wl->tx_backoff_ns += ktime_to_ns(ktime_sub(ktime_get(),
+									   attempt));
+				backoff_us = min(backoff_us * 2, (u32)TX_BACKOFF_MAX_US);
+			} else if (ret > 0) {
+				backoff_us = TX_BACKOFF_MIN_US;
 			}
-		} while (ret == WILC_TX_ERR_NO_BUF && !wl->close);
+		} while ((ret == WILC_TX_ERR_NO_BUF || (ret > 0 && txq_count)) &&
+			 --budget && !wl->close);
+		wl->txq_busy_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		/* Out of budget with frames left: come straight back after
+		 * letting others run.
+		 */
+		if (!budget) {
+			wl->txq_budget_out++;
+			set_bit(WILC_TXQ_WORK, &wl->txq_flags);
+			cond_resched();
+		}
 	}
 	return 0;
 }
@@ -990,7 +1106,6 @@ static int wlan_deinit_locks(struct net_device *dev)
 	PRINT_INFO(vif->ndev, INIT_DBG, "De-Initializing Locks\n");
 
 	mutex_destroy(&wilc->hif_cs);
-	mutex_destroy(&wilc->rxq_cs);
 	mutex_destroy(&wilc->txq_add_to_head_cs);
 	mutex_destroy(&wilc->cs);
 
@@ -1019,7 +1134,7 @@ static void wlan_deinitialize_threads(struct net_device *dev)
 	wl->close = 1;
 	PRINT_INFO(vif->ndev, INIT_DBG,"Deinitializing Threads\n");
 
-	complete(&wl->txq_event);
+	wake_up_interruptible(&wl->txq_wq);
 
 	if (wl->txq_thread) {
 		kthread_stop(wl->txq_thread);
@@ -1055,7 +1170,7 @@ static void wilc_wlan_deinitialize(struct net_device *dev)
 				mutex_unlock(&wl->hif_cs);
 			}
 		}
-		complete(&wl->txq_event);
+		wilc_wlan_txq_kick(wl);
 
 		PRINT_INFO(vif->ndev, INIT_DBG, "Deinitializing Threads\n");
 		wlan_deinitialize_threads(dev);
@@ -1089,12 +1204,11 @@ static int wlan_init_locks(struct net_device *dev)
 	wl = vif->wilc;
 	PRINT_INFO(vif->ndev, INIT_DBG, "Initializing Locks ...\n");
 
-	mutex_init(&wl->rxq_cs);
-
 	spin_lock_init(&wl->txq_spinlock);
 	mutex_init(&wl->txq_add_to_head_cs);
 
-	init_completion(&wl->txq_event);
+	init_waitqueue_head(&wl->txq_wq);
+	clear_bit(WILC_TXQ_WORK, &wl->txq_flags);
 	init_completion(&wl->cfg_event);
 	init_completion(&wl->sync_event);
 	init_completion(&wl->txq_thread_started);
@@ -1333,17 +1447,51 @@ static int wilc_mac_open(struct net_device *ndev)
 				 vif->ndev->ieee80211_ptr,
 				 vif->frame_reg[1].type,
 				 vif->frame_reg[1].reg);
+	skb_queue_purge(&vif->rx_napi_q);
+	napi_enable(&vif->napi);
 	netif_wake_queue(ndev);
 	wl->open_ifcs++;
 	vif->mac_opened = 1;
 	return 0;
 }
 
-static struct net_device_stats *mac_stats(struct net_device *dev)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+static void mac_stats(struct net_device *dev,
+		      struct rtnl_link_stats64 *stats)
+#else
+static struct rtnl_link_stats64 *mac_stats(struct net_device *dev,
+					   struct rtnl_link_stats64 *stats)
+#endif
 {
 	struct wilc_vif *vif = netdev_priv(dev);
+	struct wilc_vif_stats *s;
+	u64 rx_packets, rx_bytes, rx_dropped, tx_packets, tx_bytes, tx_dropped;
+	unsigned int start;
+	int cpu;
 
-	return &vif->netstats;
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(vif->stats, cpu);
+		do {
+			start = u64_stats_fetch_begin(&s->syncp);
+			rx_packets = s->rx_packets;
+			rx_bytes = s->rx_bytes;
+			rx_dropped = s->rx_dropped;
+			tx_packets = s->tx_packets;
+			tx_bytes = s->tx_bytes;
+			tx_dropped = s->tx_dropped;
+		} while (u64_stats_fetch_retry(&s->syncp, start));
+
+		stats->rx_packets += rx_packets;
+		stats->rx_bytes += rx_bytes;
+		stats->rx_dropped += rx_dropped;
+		stats->tx_packets += tx_packets;
+		stats->tx_bytes += tx_bytes;
+		stats->tx_dropped += tx_dropped;
+	}
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4,11,0)
+
+	return stats;
+#endif
 }
 
 static int wilc_set_mac_addr(struct net_device *dev, void *p)
@@ -1361,6 +1509,7 @@ static int wilc_set_mac_addr(struct net_device *dev, void *p)
 	result = wilc_set_mac_address(vif,(u8 *)addr->sa_data);
 	ether_addr_copy(vif->bssid, addr->sa_data);
 	ether_addr_copy(vif->ndev->dev_addr, vif->bssid);
+	wilc_rx_map_update(vif->wilc);
 
 	return result;
 }
@@ -1436,6 +1585,7 @@ netdev_tx_t wilc_mac_xmit(struct sk_buff *skb, struct net_device *ndev)
 	struct iphdr *ih;
 	struct ethhdr *eth_h;
 	struct wilc *wilc;
+	struct wilc_vif_stats *stats;
 
 	vif = netdev_priv(ndev);
 	wilc = vif->wilc;
@@ -1475,15 +1625,18 @@ netdev_tx_t wilc_mac_xmit(struct sk_buff *skb, struct net_device *ndev)
 	PRINT_D(vif->ndev, TX_DBG,"Sending pkt Size= %d Add= %p SKB= %p\n",
 		tx_data->size,tx_data->buff,tx_data->skb);
 	PRINT_D(vif->ndev, TX_DBG, "Adding tx pkt to TX Queue\n");
-	vif->netstats.tx_packets++;
-	vif->netstats.tx_bytes += tx_data->size;
+	stats = this_cpu_ptr(vif->stats);
+	u64_stats_update_begin(&stats->syncp);
+	stats->tx_packets++;
+	stats->tx_bytes += tx_data->size;
+	u64_stats_update_end(&stats->syncp);
 	tx_data->bssid = wilc->vif[vif->idx]->bssid;
 	tx_data->vif = vif;
 	queue_count = wilc_wlan_txq_add_net_pkt(ndev, (void *)tx_data,
 						tx_data->buff, tx_data->size,
 						linux_wlan_tx_complete);
 
-	if (queue_count > FLOW_CONTROL_UPPER_THRESHOLD) {
+	if (queue_count > wilc->fc_upper) {
 		netif_stop_queue(wilc->vif[0]->ndev);
 		netif_stop_queue(wilc->vif[1]->ndev);
 	}
@@ -1549,21 +1702,202 @@ static int wilc_mac_close(struct net_device *ndev)
 		WILC_WFI_deinit_mon_interface();
 	}
 
+	if (vif->mac_opened) {
+		vif->mac_opened = 0;
+		napi_disable(&vif->napi);
+		skb_queue_purge(&vif->rx_napi_q);
+	}
 	vif->mac_opened = 0;
 
 	return 0;
 }
 
+/* Bytes of a frame copied into the skb head when the rest is attached from
+ * the RX ring; enough for the Ethernet, IP and TCP headers.
+ */
+#define WILC_RX_HDR_LEN		128
+/* Frames an interface may have waiting for its NAPI poll */
+#define WILC_RX_NAPI_QLEN	1024
+
+/* Frames up to this size are copied whole: a small skb costs less than
+ * pinning ring memory for the lifetime of an ACK or ARP reply.
+ */
+static unsigned int rx_copybreak = 256;
+module_param(rx_copybreak, uint, 0644);
+MODULE_PARM_DESC(rx_copybreak, "RX frames up to this many bytes are copied instead of attached from the ring");
+
+/* Build the skb for a received frame. Frames in the RX ring get only their
+ * headers copied, the payload is attached as a fragment of the ring page.
+ * The fragment keeps the whole ring from being reused, so it is charged at
+ * least a page against the socket's receive buffer.
+ */
+static struct sk_buff *wilc_rx_skb(struct wilc *wilc, u8 *data,
+				   unsigned int len)
+{
+	struct page *page = wilc->rx_deliver_page;
+	u8 *ring = page ? page_address(page) : NULL;
+	unsigned int hlen = len;
+	struct sk_buff *skb;
+
+	if (len > rx_copybreak && page && page != wilc->rx_bounce &&
+	    data >= ring && data + len <= ring + wilc->rx_buf_size)
+		hlen = min_t(unsigned int, len, WILC_RX_HDR_LEN);
+
+	skb = dev_alloc_skb(hlen);
+	if (!skb)
+		return NULL;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,13,0)
+	skb_put_data(skb, data, hlen);
+#else
+	memcpy(skb_put(skb, hlen), data, hlen);
+#endif
+	if (hlen < len) {
+		get_page(page);
+		skb_add_rx_frag(skb, 0, page, data + hlen - ring,
+				len - hlen, max_t(unsigned int, PAGE_SIZE,
+						  SKB_DATA_ALIGN(len - hlen)));
+		wilc->rx_zc_frames++;
+		wilc->rx_zc_bytes += len;
+	} else {
+		wilc->rx_copied_frames++;
+		wilc->rx_copied_bytes += len;
+	}
+
+	return skb;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0) && LINUX_VERSION_CODE < KERNEL_VERSION(5,4,0)
+/* GRO only merges TCP; anything else gains nothing from going through it */
+static bool wilc_rx_gro_candidate(struct sk_buff *skb)
+{
+	if (skb->protocol == htons(ETH_P_IP))
+		return skb_headlen(skb) >= sizeof(struct iphdr) &&
+		       ((struct iphdr *)skb->data)->protocol == IPPROTO_TCP;
+	if (skb->protocol == htons(ETH_P_IPV6))
+		return skb_headlen(skb) >= sizeof(struct ipv6hdr) &&
+		       ((struct ipv6hdr *)skb->data)->nexthdr == IPPROTO_TCP;
+	return false;
+}
+#endif
+
+/* Hand received frames to the stack, at most budget of them. TCP goes
+ * through GRO. From 5.4 on GRO hands the frames it doesn't merge up as a
+ * list by itself; before that they are batched here.
+ */
+static int wilc_napi_poll(struct napi_struct *napi, int budget)
+{
+	struct wilc_vif *vif = container_of(napi, struct wilc_vif, napi);
+	struct wilc_vif_stats *stats;
+	struct sk_buff *skb;
+	u64 bytes = 0;
+	int done = 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0) && LINUX_VERSION_CODE < KERNEL_VERSION(5,4,0)
+	LIST_HEAD(rx_list);
+#endif
+
+	while (done < budget) {
+		skb = skb_dequeue(&vif->rx_napi_q);
+		if (!skb)
+			break;
+		done++;
+		bytes += skb->len + ETH_HLEN;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0) && LINUX_VERSION_CODE < KERNEL_VERSION(5,4,0)
+		if (!wilc_rx_gro_candidate(skb)) {
+			list_add_tail(&skb->list, &rx_list);
+			continue;
+		}
+#endif
+		napi_gro_receive(napi, skb);
+	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,19,0) && LINUX_VERSION_CODE < KERNEL_VERSION(5,4,0)
+	netif_receive_skb_list(&rx_list);
+#endif
+
+	if (done) {
+		stats = this_cpu_ptr(vif->stats);
+		u64_stats_update_begin(&stats->syncp);
+		stats->rx_packets += done;
+		stats->rx_bytes += bytes;
+		u64_stats_update_end(&stats->syncp);
+	}
+
+	if (done < budget) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)
+		/* A frame queued after the last dequeue found NAPI still
+		 * scheduled and didn't reschedule it.
+		 */
+		if (napi_complete_done(napi, done) &&
+		    !skb_queue_empty(&vif->rx_napi_q))
+			napi_schedule(napi);
+#else
+		napi_complete(napi);
+		if (!skb_queue_empty(&vif->rx_napi_q))
+			napi_schedule(napi);
+#endif
+	}
+
+	return done;
+}
+
+static u32 rx_hash_seed __read_mostly;
+
+/* Give received IP frames a flow hash so RPS can spread them without
+ * hashing in software: L4 for TCP and UDP, L3 for fragments and the rest.
+ * The headers are in the linear part of the skb.
+ */
+static void wilc_rx_set_hash(struct sk_buff *skb)
+{
+	const u8 *end = skb->data + skb_headlen(skb);
+	const u8 *l4 = NULL;
+	u32 hash, ports;
+	u8 proto;
+
+	if (skb->protocol == htons(ETH_P_IP)) {
+		const struct iphdr *iph = (const struct iphdr *)skb->data;
+
+		if (skb_headlen(skb) < sizeof(*iph) || iph->ihl < 5)
+			return;
+		net_get_random_once(&rx_hash_seed, sizeof(rx_hash_seed));
+		hash = jhash_2words((__force u32)iph->saddr,
+				    (__force u32)iph->daddr, rx_hash_seed);
+		proto = iph->protocol;
+		if (!ip_is_fragment(iph))
+			l4 = skb->data + iph->ihl * 4;
+	} else if (skb->protocol == htons(ETH_P_IPV6)) {
+		const struct ipv6hdr *ip6h = (const struct ipv6hdr *)skb->data;
+
+		if (skb_headlen(skb) < sizeof(*ip6h))
+			return;
+		net_get_random_once(&rx_hash_seed, sizeof(rx_hash_seed));
+		/* saddr and daddr are adjacent: 8 words */
+		hash = jhash2((const u32 *)&ip6h->saddr, 8, rx_hash_seed);
+		proto = ip6h->nexthdr;
+		l4 = skb->data + sizeof(*ip6h);
+	} else {
+		return;
+	}
+
+	if (l4 && (proto == IPPROTO_TCP || proto == IPPROTO_UDP) &&
+	    l4 + sizeof(ports) <= end) {
+		memcpy(&ports, l4, sizeof(ports));
+		hash = jhash_2words(hash, ports, proto);
+		skb_set_hash(skb, hash ?: 1, PKT_HASH_TYPE_L4);
+	} else {
+		skb_set_hash(skb, hash ?: 1, PKT_HASH_TYPE_L3);
+	}
+}
+
 void wilc_frmw_to_linux(struct wilc *wilc, u8 *buff, u32 size, u32 pkt_offset,
 			u8 status)
 {
 	unsigned int frame_len = 0;
-	int stats;
 	unsigned char *buff_to_send = NULL;
 	struct sk_buff *skb;
 	struct net_device *wilc_netdev;
 	struct wilc_vif *vif;
 	struct wilc_priv *priv;
+	struct wilc_vif_stats *stats;
 	u8 null_bssid[ETH_ALEN] = {0};
 
 	if (!wilc)
@@ -1614,7 +1948,21 @@ void wilc_frmw_to_linux(struct wilc *wilc, u8 *buff, u32 size, u32 pkt_offset,
                                       msecs_to_jiffies(10))) ;
 			return;
 		}
-		skb = dev_alloc_skb(frame_len);
+		/* Nothing drains the queue of a closed interface, and a
+		 * stalled poll must not let it grow without bound.
+		 */
+		if (!vif->mac_opened ||
+		    skb_queue_len(&vif->rx_napi_q) >= WILC_RX_NAPI_QLEN) {
+			local_bh_disable();
+			stats = this_cpu_ptr(vif->stats);
+			u64_stats_update_begin(&stats->syncp);
+			stats->rx_dropped++;
+			u64_stats_update_end(&stats->syncp);
+			local_bh_enable();
+			return;
+		}
+
+		skb = wilc_rx_skb(wilc, buff_to_send, frame_len);
 		if (!skb) {
        	 		PRINT_ER(wilc_netdev, "Low memory - packet droped\n");
 			return;
@@ -1625,24 +1973,38 @@ void wilc_frmw_to_linux(struct wilc *wilc, u8 *buff, u32 size, u32 pkt_offset,
 		skb->dev = wilc_netdev;
 		if (skb->dev == NULL)
 			PRINT_ER(wilc_netdev, "skb->dev is NULL\n");
-	#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,13,0)
-		skb_put_data(skb, buff_to_send, frame_len);
-	#else
-		memcpy(skb_put(skb, frame_len), buff_to_send, frame_len);
-	#endif
 
 		skb->protocol = eth_type_trans(skb, wilc_netdev);
-		vif->netstats.rx_packets++;
-		vif->netstats.rx_bytes += frame_len;
+		wilc_rx_set_hash(skb);
 		skb->ip_summed = CHECKSUM_UNNECESSARY;
-		stats = netif_rx(skb);
-		PRINT_D(wilc_netdev, RX_DBG, "netif_rx ret value is: %d\n", stats);
+		skb_queue_tail(&vif->rx_napi_q, skb);
+		/* The RX path schedules NAPI once the whole batch is queued */
+		if (!wilc->rx_batch) {
+			local_bh_disable();
+			napi_schedule(&vif->napi);
+			local_bh_enable();
+		}
 	} else {
 		PRINT_ER(wilc_netdev,
 			 "Discard sending packet with len = %d\n", size);
 	}
 }
 
+/* Run NAPI for every interface with frames queued. The poll starts as soon
+ * as bottom halves are enabled again rather than waiting for ksoftirqd.
+ */
+void wilc_rx_flush(struct wilc *wilc)
+{
+	int i;
+
+	local_bh_disable();
+	for (i = 0; i < NUM_CONCURRENT_IFC; i++) {
+		if (wilc->vif[i] && !skb_queue_empty(&wilc->vif[i]->rx_napi_q))
+			napi_schedule(&wilc->vif[i]->napi);
+	}
+	local_bh_enable();
+}
+
 void wilc_wfi_mgmt_rx(struct wilc *wilc, u8 *buff, u32 size)
 {
 	int i = 0;
@@ -1695,6 +2057,8 @@ void wilc_netdev_cleanup(struct wilc *wilc)
 				PRINT_INFO(wilc->vif[i]->ndev, INIT_DBG,
 					   "Freeing netdev...\n");
 			}
+			if (wilc->vif[i])
+				free_percpu(wilc->vif[i]->stats);
 			free_netdev(wilc->vif[i]->ndev);
 		}
 	}
@@ -1703,6 +2067,8 @@ void wilc_netdev_cleanup(struct wilc *wilc)
 		unregister_inetaddr_notifier(&g_dev_notifier);
 	#endif
 
+	if (wilc)
+		wilc_wlan_rx_evt_deinit(wilc);
 	kfree(wilc);
 	wilc_sysfs_exit();
 	wilc_debugfs_remove();
@@ -1715,7 +2081,7 @@ static const struct net_device_ops wilc_netdev_ops = {
 	.ndo_stop = wilc_mac_close,
 	.ndo_set_mac_address = wilc_set_mac_addr,
 	.ndo_start_xmit = wilc_mac_xmit,
-	.ndo_get_stats = mac_stats,
+	.ndo_get_stats64 = mac_stats,
 	.ndo_set_rx_mode  = wilc_set_multicast_list,
 };
 
@@ -1728,11 +2094,19 @@ int wilc_netdev_init(struct wilc **wilc, struct device *dev, int io_type,
 	struct wilc *wl;
 	struct wireless_dev *wdev;
 
-	wilc_debugfs_init();
 	wl = kzalloc(sizeof(*wl), GFP_KERNEL);
 	if (!wl)
 		return -ENOMEM;
 
+	init_llist_head(&wl->tx_stage);
+	seqlock_init(&wl->rx_map_lock);
+	if (wilc_wlan_rx_evt_init(wl)) {
+		kfree(wl);
+		return -ENOMEM;
+	}
+
+	wilc_debugfs_init(wl);
+
 	*wilc = wl;
 	wl->io_type = io_type;
 	wl->hif_func = ops;
@@ -1748,6 +2122,11 @@ int wilc_netdev_init(struct wilc **wilc, struct device *dev, int io_type,
 
 		vif = netdev_priv(ndev);
 		memset(vif, 0, sizeof(struct wilc_vif));
+		vif->stats = netdev_alloc_pcpu_stats(struct wilc_vif_stats);
+		if (!vif->stats) {
+			free_netdev(ndev);
+			return -ENOMEM;
+		}
 
 		if (i == 0)
 			strcpy(ndev->name, "wlan%d");
@@ -1762,6 +2141,13 @@ int wilc_netdev_init(struct wilc **wilc, struct device *dev, int io_type,
 
 
 		ndev->netdev_ops = &wilc_netdev_ops;
+		skb_queue_head_init(&vif->rx_napi_q);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,1,0)
+		netif_napi_add(ndev, &vif->napi, wilc_napi_poll);
+#else
+		netif_napi_add(ndev, &vif->napi, wilc_napi_poll,
+			       NAPI_POLL_WEIGHT);
+#endif
 
 		wdev = wilc_create_wiphy(ndev, dev);
 
@@ -1776,10 +2162,6 @@ int wilc_netdev_init(struct wilc **wilc, struct device *dev, int io_type,
 		vif->ndev->ieee80211_ptr = wdev;
 		vif->ndev->ml_priv = vif;
 		wdev->netdev = vif->ndev;
-		vif->netstats.rx_packets = 0;
-		vif->netstats.tx_packets = 0;
-		vif->netstats.rx_bytes = 0;
-		vif->netstats.tx_bytes = 0;
 
 		ret = register_netdev(ndev);
 		if (ret) {
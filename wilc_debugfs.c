@@ -17,8 +17,10 @@
 #include <linux/sched.h>
 
 #include "wilc_debugfs.h"
+#include "wilc_wfi_netdevice.h"
 
 static struct dentry *wilc_dir;
+static struct wilc *wilc_dev;
 
 /*
  * ----------------------------------------------------------------------------
@@ -72,6 +74,122 @@ static ssize_t wilc_debug_region_write(struct file *filp,
 	return count;
 }
 
+static ssize_t wilc_tx_stats_read(struct file *file, char __user *userbuf,
+				  size_t count, loff_t *ppos)
+{
+	static const char * const ac_name[NQUEUES] = {"VO", "VI", "BE", "BK"};
+	struct txq_handle *ctrl;
+	u64 avoided = 0;
+	char buf[1024];
+	int res = 0;
+	int ac;
+
+	if (*ppos > 0 || !wilc_dev)
+		return 0;
+
+	for (ac = 0; ac < NQUEUES; ac++)
+		res += scnprintf(buf + res, sizeof(buf) - res,
+				 "AC_%s: queued %u/%u bytes %u/%u aged_out %u\n",
+				 ac_name[ac],
+				 wilc_dev->txq[ac].count,
+				 wilc_dev->txq_est.pkt_limit[ac],
+				 wilc_dev->txq[ac].bytes,
+				 wilc_dev->txq_est.byte_limit[ac],
+				 wilc_dev->txq[ac].aged_out);
+	res += scnprintf(buf + res, sizeof(buf) - res, "staged: %d\n",
+			 atomic_read(&wilc_dev->tx_staged));
+	ctrl = &wilc_dev->txq[WILC_CTRL_Q];
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "CTRL: queued %u bytes %u sent %u\n",
+			 ctrl->count, ctrl->bytes, ctrl->sent);
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "ack_filter: enabled %d sessions %u dropped %u untracked %u\n",
+			 wilc_dev->ack_filter.enabled,
+			 wilc_dev->ack_filter.sessions,
+			 wilc_dev->ack_filter.dropped,
+			 wilc_dev->ack_filter.untracked);
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "ack_filter: ack_ratio %u%% peak_qlen %u enables %u disables %u\n",
+			 wilc_dev->ack_filter.last_ratio,
+			 wilc_dev->ack_filter.last_peak,
+			 wilc_dev->ack_filter.enables,
+			 wilc_dev->ack_filter.disables);
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "tx_cfg: tx_buf %u rx_buf %u vmm_batch %u last_xfer_us %u fc %u/%u\n",
+			 wilc_dev->tx_buf_size, wilc_dev->rx_buf_size,
+			 wilc_dev->vmm_batch, wilc_dev->tx_xfer_us,
+			 wilc_dev->fc_lower, wilc_dev->fc_upper);
+	/* Without backoff the thread would have spent the backoff time
+	 * retrying, each refused attempt costing about nobuf_ns / nobuf.
+	 */
+	if (wilc_dev->tx_nobuf && wilc_dev->tx_nobuf_ns)
+		avoided = div64_u64(wilc_dev->tx_backoff_ns * wilc_dev->tx_nobuf,
+				    wilc_dev->tx_nobuf_ns);
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "tx_backoff: nobuf %u refused_bus_us %llu backoff_us %llu avoided_attempts %llu\n",
+			 wilc_dev->tx_nobuf,
+			 div_u64(wilc_dev->tx_nobuf_ns, NSEC_PER_USEC),
+			 div_u64(wilc_dev->tx_backoff_ns, NSEC_PER_USEC),
+			 avoided);
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "txq_thread: wakeups %u budget_out %u idle_ms %llu busy_ms %llu\n",
+			 wilc_dev->txq_wakeups, wilc_dev->txq_budget_out,
+			 div_u64(wilc_dev->txq_idle_ns, NSEC_PER_MSEC),
+			 div_u64(wilc_dev->txq_busy_ns, NSEC_PER_MSEC));
+
+	return simple_read_from_buffer(userbuf, count, ppos, buf, res);
+}
+
+static ssize_t wilc_rx_stats_read(struct file *file, char __user *userbuf,
+				  size_t count, loff_t *ppos)
+{
+	char buf[1024];
+	int res = 0;
+
+	if (*ppos > 0 || !wilc_dev)
+		return 0;
+
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "rx: irqs %u transfers %u drain_out %u bytes %llu\n",
+			 wilc_dev->rx_irqs, wilc_dev->rx_transfers,
+			 wilc_dev->rx_drain_out, wilc_dev->rx_xfer_bytes);
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "rx_time: pending %u no_room %u bus_us %llu deliver_us %llu\n",
+			 wilc_dev->rx_head - wilc_dev->rx_tail,
+			 wilc_dev->rx_no_room,
+			 div_u64(wilc_dev->rx_bus_ns, NSEC_PER_USEC),
+			 div_u64(wilc_dev->rx_deliver_ns, NSEC_PER_USEC));
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "rx_evt: handled %u queued %u dropped %u\n",
+			 wilc_dev->rx_evt_msgs,
+			 skb_queue_len(&wilc_dev->rx_evt_q),
+			 wilc_dev->rx_evt_drops);
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "net_info: batched %u batches %u unbatched %u\n",
+			 wilc_dev->net_info_msgs, wilc_dev->net_info_batches,
+			 wilc_dev->net_info_unbatched);
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "irq_mode: %s enter_poll %u exit_poll %u polls %u empty %u\n",
+			 wilc_dev->irq_polling ? "poll" : "irq",
+			 wilc_dev->irq_poll_enter, wilc_dev->irq_poll_exit,
+			 wilc_dev->irq_polls, wilc_dev->irq_polls_empty);
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "rx_ring: reused %u allocated %u failed %u bounced %u zero_copy %u copied %u\n",
+			 wilc_dev->rx_ring_reused, wilc_dev->rx_ring_allocs,
+			 wilc_dev->rx_ring_fail, wilc_dev->rx_bounced,
+			 wilc_dev->rx_zc_frames, wilc_dev->rx_copied_frames);
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "rx_size: ring %u hwm %u burst_max %u overflow %u wraps %u tail_waste %llu\n",
+			 wilc_dev->rx_buf_size, wilc_dev->rx_ring_hwm,
+			 wilc_dev->rx_burst_max, wilc_dev->rx_no_room,
+			 wilc_dev->rx_wraps, wilc_dev->rx_tail_waste);
+	res += scnprintf(buf + res, sizeof(buf) - res,
+			 "rx_bytes: zero_copy %llu copied %llu\n",
+			 wilc_dev->rx_zc_bytes, wilc_dev->rx_copied_bytes);
+
+	return simple_read_from_buffer(userbuf, count, ppos, buf, res);
+}
+
 /*
  * ----------------------------------------------------------------------------
  */
@@ -98,13 +216,27 @@ static struct wilc_debugfs_info_t debugfs_info[] = {
 		0,
 		FOPS(NULL, wilc_debug_region_read, wilc_debug_region_write, NULL),
 	},
+	{
+		"wilc_tx_stats",
+		0444,
+		0,
+		FOPS(NULL, wilc_tx_stats_read, NULL, NULL),
+	},
+	{
+		"wilc_rx_stats",
+		0444,
+		0,
+		FOPS(NULL, wilc_rx_stats_read, NULL, NULL),
+	},
 };
 
-int wilc_debugfs_init(void)
+int wilc_debugfs_init(struct wilc *wilc)
 {
 	int i;
 	struct wilc_debugfs_info_t *info;
 
+	wilc_dev = wilc;
+
 	wilc_dir = debugfs_create_dir("wilc", NULL);
 	if(wilc_dir == NULL) {
 		pr_err("Error creating debugfs\n");
@@ -124,6 +256,7 @@ int wilc_debugfs_init(void)
 void wilc_debugfs_remove(void)
 {
 	debugfs_remove_recursive(wilc_dir);
+	wilc_dev = NULL;
 }
 
 #endif
@@ -49,6 +49,7 @@ extern atomic_t WILC_DEBUG_REGION;
 #define PRINT_ER(netdev, format,...) do{ netdev_err(netdev, "ERR [%s: %d] "format,\
 	__FUNCTION__,__LINE__, ##__VA_ARGS__);}while(0)
 
-int wilc_debugfs_init(void);
+struct wilc;
+int wilc_debugfs_init(struct wilc *wilc);
 void wilc_debugfs_remove(void);
 #endif /* WILC_DEBUGFS_H */
@@ -82,8 +82,6 @@ static const struct wiphy_wowlan_support wowlan_support = {
 	.flags = WIPHY_WOWLAN_ANY
 };
 
-#define TCP_ACK_FILTER_LINK_SPEED_THRESH	54
-#define DEFAULT_LINK_SPEED			72
 
 #define GET_PKT_OFFSET(a) (((a) >> 22) & 0x1ff)
 
@@ -1462,12 +1460,6 @@ static int get_station(struct wiphy *wiphy, struct net_device *dev,
 		sinfo->tx_failed = stats.tx_fail_cnt;
 		sinfo->txrate.legacy = stats.link_speed * 10;
 
-		if (stats.link_speed > TCP_ACK_FILTER_LINK_SPEED_THRESH &&
-		    stats.link_speed != DEFAULT_LINK_SPEED)
-			wilc_enable_tcp_ack_filter(true);
-		else if (stats.link_speed != DEFAULT_LINK_SPEED)
-			wilc_enable_tcp_ack_filter(false);
-
 		PRINT_INFO(vif->ndev, CORECONFIG_DBG,
 			   "*** stats[%d][%d][%d][%d][%d]\n",sinfo->signal,
 			   sinfo->rx_packets,sinfo->tx_packets,
@@ -2331,6 +2323,7 @@ static int change_virtual_intf(struct wiphy *wiphy, struct net_device *dev,
 		priv->wdev->iftype = type;
 		vif->monitor_flag = 0;
 		vif->iftype = STATION_MODE;
+		wilc_rx_map_update(vif->wilc);
 		wilc_set_wfi_drv_handler(vif, wilc_get_vif_idx(vif),
 					 STATION_MODE, vif->ifc_id);
 		wilc_set_operation_mode(vif, STATION_MODE);
@@ -2351,6 +2344,7 @@ static int change_virtual_intf(struct wiphy *wiphy, struct net_device *dev,
 		priv->wdev->iftype = type;
 		vif->monitor_flag = 0;
 		vif->iftype = CLIENT_MODE;
+		wilc_rx_map_update(vif->wilc);
 		wilc_enable_ps = false;
 		wilc_set_wfi_drv_handler(vif, wilc_get_vif_idx(vif),
 					 STATION_MODE, vif->ifc_id);
@@ -2366,6 +2360,7 @@ static int change_virtual_intf(struct wiphy *wiphy, struct net_device *dev,
 		dev->ieee80211_ptr->iftype = type;
 		priv->wdev->iftype = type;
 		vif->iftype = AP_MODE;
+		wilc_rx_map_update(vif->wilc);
 		wilc_enable_ps = false;
 		if (wl->initialized) {
 			wilc_set_wfi_drv_handler(vif, wilc_get_vif_idx(vif),
@@ -2387,6 +2382,7 @@ static int change_virtual_intf(struct wiphy *wiphy, struct net_device *dev,
 		dev->ieee80211_ptr->iftype = type;
 		priv->wdev->iftype = type;
 		vif->iftype = GO_MODE;
+		wilc_rx_map_update(vif->wilc);
 		wilc_set_wfi_drv_handler(vif, wilc_get_vif_idx(vif),
 						 AP_MODE, vif->ifc_id);
 		wilc_set_operation_mode(vif, AP_MODE);
@@ -42,6 +42,8 @@
 #include <linux/wireless.h>
 #include <linux/completion.h>
 #include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/u64_stats_sync.h>
 
 #define FLOW_CONTROL_LOWER_THRESHOLD	128
 #define FLOW_CONTROL_UPPER_THRESHOLD	256
@@ -145,19 +147,36 @@ typedef struct {
 	u8 antenna2;
 } sysfs_attr_group;
 
+/* Per-CPU interface counters. Only updated with bottom halves disabled:
+ * from xmit and the NAPI poll, and from the TX and IRQ threads under
+ * local_bh_disable, so updates on one CPU never nest.
+ */
+struct wilc_vif_stats {
+	u64 rx_packets;
+	u64 rx_bytes;
+	u64 rx_dropped;
+	u64 tx_packets;
+	u64 tx_bytes;
+	u64 tx_dropped;
+	struct u64_stats_sync syncp;
+};
+
 struct wilc_vif {
 	u8 idx;
 	u8 iftype;
 	int monitor_flag;
 	int mac_opened;
 	struct frame_reg frame_reg[NUM_REG_FRAME];
-	struct net_device_stats netstats;
+	struct wilc_vif_stats __percpu *stats;
 	struct wilc *wilc;
 	u8 src_addr[ETH_ALEN];
 	u8 bssid[ETH_ALEN];
 	struct host_if_drv *hif_drv;
 	struct net_device *ndev;
 	u8 ifc_id;
+	struct napi_struct napi;
+	/* frames received for this vif, waiting for the NAPI poll */
+	struct sk_buff_head rx_napi_q;
 
 	sysfs_attr_group attr_sysfs;
 #ifdef DISABLE_PWRSAVE_AND_SCAN_DURING_IP
@@ -165,6 +184,23 @@ struct wilc_vif {
 #endif
 };
 
+/* BSSID to interface map for demultiplexing received data frames, rebuilt
+ * by wilc_rx_map_update whenever a vif's BSSID or mode changes.
+ */
+struct wilc_rx_map_entry {
+	u8 bssid[ETH_ALEN];
+	/* of the BSSID in the 802.11 header: addr2 in station mode, addr1 as AP */
+	u8 offset;
+	struct net_device *ndev;
+};
+
+struct wilc_rx_map {
+	u8 num;
+	/* vifs with a non-zero BSSID, whatever their mode */
+	u8 conn;
+	struct wilc_rx_map_entry entry[NUM_CONCURRENT_IFC];
+};
+
 struct wilc {
 	const struct wilc_hif_func *hif_func;
 	int io_type;
@@ -182,16 +218,37 @@ struct wilc {
 	struct mutex txq_add_to_head_cs;
 	spinlock_t txq_spinlock;
 
-	struct mutex rxq_cs;
 	struct mutex hif_cs;
 
 	struct completion cfg_event;
 	struct completion sync_event;
-	struct completion txq_event;
+	wait_queue_head_t txq_wq;
+	unsigned long txq_flags;
 	struct completion txq_thread_started;
 	struct completion debug_thread_started;
 	struct task_struct *txq_thread;
 	struct task_struct *debug_thread;
+	u32 txq_wakeups;
+	u32 txq_budget_out;
+	u32 tx_nobuf;
+	u64 tx_nobuf_ns;
+	u64 tx_backoff_ns;
+	u32 rx_irqs;
+	/* adaptive IRQ/poll mode, see isr_bh_routine */
+	bool irq_polling;
+	ktime_t irq_win_start;
+	u32 irq_win_count;
+	u32 irq_poll_enter;
+	u32 irq_poll_exit;
+	u32 irq_polls;
+	u32 irq_polls_empty;
+	u32 rx_transfers;
+	u32 rx_drain_out;
+	u64 rx_xfer_bytes;
+	u64 rx_bus_ns;
+	u64 rx_deliver_ns;
+	u64 txq_idle_ns;
+	u64 txq_busy_ns;
 
 	int quit;
 	int cfg_frame_in_use;
@@ -201,20 +258,71 @@ struct wilc {
 
 	u8 *rx_buffer;
 	u32 rx_buffer_offset;
+	/* page behind rx_buffer: one of rx_rings, or rx_bounce once all of
+	 * them are held by the stack; frames in rx_bounce are always copied
+	 */
+	struct page *rx_page;
+	struct page *rx_rings[WILC_RX_RINGS];
+	struct page *rx_bounce;
+	/* ring of the transfer being delivered */
+	struct page *rx_deliver_page;
+	u32 rx_ring_reused;
+	u32 rx_ring_allocs;
+	u32 rx_ring_fail;
+	u32 rx_bounced;
+	u32 rx_zc_frames;
+	u32 rx_copied_frames;
+	u64 rx_zc_bytes;
+	u64 rx_copied_bytes;
 	u8 *tx_buffer;
+	/* buffer and batch sizes, taken from the module parameters on init */
+	u32 rx_buf_size;
+	u32 tx_buf_size;
+	u16 vmm_batch;
+	u16 fc_lower;
+	u16 fc_upper;
+	u32 tx_xfer_us;
 
-	unsigned long txq_spinlock_flags;
 
 	struct txq_entry_t *txq_head;
 	struct txq_entry_t *txq_tail;
-	struct txq_handle txq[NQUEUES];
+	struct txq_handle txq[WILC_TXQ_NUM];
 	int txq_entries;
 	int txq_exit;
-
-	struct rxq_entry_t *rxq_head;
-	struct rxq_entry_t *rxq_tail;
-	int rxq_entries;
-	int rxq_exit;
+	struct wilc_ack_filter ack_filter;
+	struct wilc_txq_est txq_est;
+	/* data frames queued by wilc_mac_xmit until the TX thread moves them
+	 * to the AC queues, newest first
+	 */
+	struct llist_head tx_stage;
+	atomic_t tx_staged;
+
+	/* rx_head is advanced by the bus phase, rx_tail by the delivery phase */
+	struct wilc_rx_desc rx_desc[WILC_RX_DESC_NUM];
+	u32 rx_head;
+	u32 rx_tail;
+	u32 rx_no_room;
+	/* most ring bytes held by undelivered transfers, largest burst read
+	 * per interrupt, and ring space skipped when wrapping
+	 */
+	u32 rx_ring_hwm;
+	u32 rx_burst_max;
+	u32 rx_wraps;
+	u64 rx_tail_waste;
+	/* config responses and firmware events, see wilc_wlan_rx_evt_work */
+	struct workqueue_struct *rx_evt_wq;
+	struct work_struct rx_evt_work;
+	struct sk_buff_head rx_evt_q;
+	u32 rx_evt_msgs;
+	u32 rx_evt_drops;
+	/* network-info messages batched, batches handled, sent one by one */
+	u32 net_info_msgs;
+	u32 net_info_batches;
+	u32 net_info_unbatched;
+	seqlock_t rx_map_lock;
+	struct wilc_rx_map rx_map;
+	/* set while wilc_wlan_handle_rxq queues frames for NAPI */
+	bool rx_batch;
 
 	unsigned char eth_src_address[NUM_CONCURRENT_IFC][6];
 
@@ -246,5 +354,6 @@ int wilc_netdev_init(struct wilc **wilc, struct device *dev, int io_type,
 		     const struct wilc_hif_func *ops);
 void wilc_wfi_mgmt_rx(struct wilc *wilc, u8 *buff, u32 size);
 int wilc_wlan_set_bssid(struct net_device *wilc_netdev, u8 *bssid, u8 mode);
+void wilc_rx_map_update(struct wilc *wilc);
 
 #endif
@@ -1,5 +1,10 @@
 // SPDX-License-Identifier: GPL-2.0
 #include <linux/completion.h>
+#include <linux/if_vlan.h>
+#include <linux/ipv6.h>
+#include <linux/jhash.h>
+#include <linux/workqueue.h>
+#include <linux/mm.h>
 #include "wilc_wlan_if.h"
 #include "wilc_wlan.h"
 #include "linux_wlan.h"
@@ -8,8 +13,92 @@
 
 #define WAKUP_TRAILS_TIMEOUT		(10000)
 
+/* Longest time a data frame may wait in its AC queue (VO, VI, BE, BK).
+ * Older frames are dropped while the next VMM batch is built. 0 disables
+ * aging for that AC.
+ */
+static unsigned int tx_deadline_ms[NQUEUES] = {40, 100, 0, 0};
+module_param_array(tx_deadline_ms, uint, NULL, 0644);
+MODULE_PARM_DESC(tx_deadline_ms, "Per-AC TX queueing deadline in ms (VO,VI,BE,BK), 0 = never age");
+
+/* Byte budget shared by the AC queues in proportion to their traffic */
+static unsigned int tx_byte_limit = 192 * 1024;
+module_param(tx_byte_limit, uint, 0644);
+MODULE_PARM_DESC(tx_byte_limit, "Total bytes the AC queues may hold");
+
+/* Buffer, batch and flow control sizes. They are applied by wilc_wlan_init,
+ * so changes take effect the next time the interface is brought up.
+ */
+static unsigned int tx_buf_size = LINUX_TX_SIZE;
+module_param(tx_buf_size, uint, 0644);
+MODULE_PARM_DESC(tx_buf_size, "TX transfer buffer in bytes (4K..64K)");
+
+static unsigned int rx_buf_size = LINUX_RX_SIZE;
+module_param(rx_buf_size, uint, 0644);
+MODULE_PARM_DESC(rx_buf_size, "RX ring buffer in bytes (64K..256K)");
+
+static bool rx_buf_auto;
+module_param(rx_buf_auto, bool, 0644);
+MODULE_PARM_DESC(rx_buf_auto, "Size the RX ring from the largest burst seen so far instead of rx_buf_size, keeping all RX rings within 1/512 of RAM but none below 64K");
+
+static unsigned int tx_vmm_batch = WILC_VMM_TBL_SIZE - 1;
+module_param(tx_vmm_batch, uint, 0644);
+MODULE_PARM_DESC(tx_vmm_batch, "Most frames per VMM TX batch (1..63)");
+
+static unsigned int tx_autotune_us;
+module_param(tx_autotune_us, uint, 0644);
+MODULE_PARM_DESC(tx_autotune_us, "Target bus time per TX batch in us for batch autotuning, 0 = off");
+
+static unsigned int fc_upper = FLOW_CONTROL_UPPER_THRESHOLD;
+module_param(fc_upper, uint, 0644);
+MODULE_PARM_DESC(fc_upper, "Queued frames at which the net queues are stopped");
+
+static unsigned int fc_lower = FLOW_CONTROL_LOWER_THRESHOLD;
+module_param(fc_lower, uint, 0644);
+MODULE_PARM_DESC(fc_lower, "Queued frames below which the net queues are woken (at least 1)");
+
+/* TCP ACK filter control. In auto mode the filter is switched on once the
+ * TX queues back up with a high share of pure ACKs and switched off again
+ * when either falls below the lower threshold.
+ */
+static unsigned int ack_filter_mode = ACK_FILTER_AUTO;
+module_param(ack_filter_mode, uint, 0644);
+MODULE_PARM_DESC(ack_filter_mode, "TCP ACK filter: 0 = auto, 1 = always on, 2 = off");
+
+#define ACK_FILTER_WINDOW_MS		100
+#define ACK_FILTER_MIN_ACKS		16
+#define ACK_FILTER_ON_RATIO		50
+#define ACK_FILTER_OFF_RATIO		20
+#define ACK_FILTER_ON_QLEN		8
+#define ACK_FILTER_OFF_QLEN		2
+
+/* DSCP (TOS >> 2) to AC map used for IPv4 and IPv6 data frames. */
+static u8 dscp_to_ac[64] = {
+	[0 ... 63] = AC_BE_Q,
+	[2] = AC_BK_Q,
+	[8] = AC_BK_Q,
+	[16] = AC_BK_Q,
+	[10] = AC_VI_Q,
+	[32] = AC_VI_Q,
+	[40] = AC_VI_Q,
+	[34] = AC_VO_Q,
+	[46] = AC_VO_Q,
+	[48] = AC_VO_Q,
+	[52] = AC_VO_Q,
+	[56] = AC_VO_Q,
+};
+module_param_array(dscp_to_ac, byte, NULL, 0644);
+MODULE_PARM_DESC(dscp_to_ac, "AC (0=VO,1=VI,2=BE,3=BK) for each of the 64 DSCP values");
+
+/* 802.1D user priority to AC */
+static const u8 up_to_ac[8] = {
+	AC_BE_Q, AC_BK_Q, AC_BK_Q, AC_BE_Q,
+	AC_VI_Q, AC_VI_Q, AC_VO_Q, AC_VO_Q
+};
+
 extern void wilc_frmw_to_linux(struct wilc *wilc, u8 *buff, u32 size,
 				u32 pkt_offset, u8 status);
+extern void wilc_rx_flush(struct wilc *wilc);
 
 void acquire_bus(struct wilc *wilc, enum bus_acquire acquire, int source)
 {
@@ -33,9 +122,191 @@ uint8_t reset_bus(struct wilc *wilc)
 	return ret;
 }
 
+static inline bool tcp_ack_before(u32 seq1, u32 seq2)
+{
+	return (s32)(seq1 - seq2) < 0;
+}
+
+static void wilc_wlan_ack_filter_init(struct wilc *wilc)
+{
+	struct wilc_ack_filter *f = &wilc->ack_filter;
+	int i;
+
+	for (i = 0; i < WILC_ACK_HASH_SIZE; i++)
+		INIT_HLIST_HEAD(&f->hash[i]);
+	INIT_HLIST_HEAD(&f->free);
+	for (i = 0; i < WILC_MAX_TCP_SESSION; i++)
+		hlist_add_head(&f->session[i].node, &f->free);
+	INIT_LIST_HEAD(&f->pending);
+	f->sessions = 0;
+	f->win_start = jiffies;
+	f->win_pkts = 0;
+	f->win_acks = 0;
+	f->win_peak = 0;
+}
+
+static void ack_filter_set(struct wilc_ack_filter *f, bool enable)
+{
+	if (f->enabled == enable)
+		return;
+	f->enabled = enable;
+	if (enable)
+		f->enables++;
+	else
+		f->disables++;
+}
+
+/* Re-evaluate the ACK filter once per window from the share of pure ACKs
+ * among queued data frames and the deepest the queues got. The gap between
+ * the on and off thresholds keeps the filter from flapping.
+ */
+static void wilc_wlan_ack_filter_update(struct wilc *wilc)
+{
+	struct wilc_ack_filter *f = &wilc->ack_filter;
+	unsigned long flags;
+	u32 ratio;
+
+	if (ack_filter_mode != ACK_FILTER_AUTO) {
+		ack_filter_set(f, ack_filter_mode == ACK_FILTER_ON);
+		return;
+	}
+
+	if (time_before(jiffies, f->win_start +
+			msecs_to_jiffies(ACK_FILTER_WINDOW_MS)))
+		return;
+
+	spin_lock_irqsave(&wilc->txq_spinlock, flags);
+	ratio = f->win_pkts ? f->win_acks * 100 / f->win_pkts : 0;
+	f->last_ratio = ratio;
+	f->last_peak = f->win_peak;
+
+	if (!f->enabled) {
+		if (f->win_acks >= ACK_FILTER_MIN_ACKS &&
+		    ratio >= ACK_FILTER_ON_RATIO &&
+		    f->win_peak >= ACK_FILTER_ON_QLEN)
+			ack_filter_set(f, true);
+	} else if (ratio < ACK_FILTER_OFF_RATIO ||
+		   f->win_peak < ACK_FILTER_OFF_QLEN) {
+		ack_filter_set(f, false);
+	}
+
+	f->win_start = jiffies;
+	f->win_pkts = 0;
+	f->win_acks = 0;
+	f->win_peak = wilc->txq_entries;
+	spin_unlock_irqrestore(&wilc->txq_spinlock, flags);
+}
+
+/* Called with txq_spinlock held */
+static void tcp_ack_release(struct wilc *wilc, struct txq_entry_t *tqe)
+{
+	struct tcp_ack_session *s = tqe->ack_session;
+
+	if (!s)
+		return;
+
+	list_del(&tqe->ack_list);
+	tqe->ack_session = NULL;
+	if (--s->pending == 0) {
+		hlist_del(&s->node);
+		hlist_add_head(&s->node, &wilc->ack_filter.free);
+		wilc->ack_filter.sessions--;
+	}
+}
+
+/* Count pure TCP ACKs for the filter controller and, while the filter is
+ * on, track them so that older ACKs of the same flow still waiting in the
+ * queues can be dropped. Flows are keyed by the full IPv4/IPv6 address and
+ * port tuple. Called with txq_spinlock held.
+ */
+static void tcp_process(struct wilc *wilc, struct txq_entry_t *tqe)
+{
+	struct wilc_ack_filter *f = &wilc->ack_filter;
+	struct tcp_ack_session *s;
+	struct tcp_ack_key key;
+	u8 *buffer = tqe->buffer;
+	u8 *ip_hdr_ptr, *tcp_hdr_ptr;
+	u32 l3_len, data_offset, ack_no, hash;
+
+	f->win_pkts++;
+	if (wilc->txq_entries > f->win_peak)
+		f->win_peak = wilc->txq_entries;
+
+	/* Header offsets were recorded by ac_classify */
+	if (tqe->ip_proto != IPPROTO_TCP || !tqe->th_offset ||
+	    tqe->buffer_size < tqe->th_offset + sizeof(struct tcphdr))
+		return;
+
+	ip_hdr_ptr = &buffer[tqe->nh_offset];
+	tcp_hdr_ptr = &buffer[tqe->th_offset];
+
+	/* ACK set, no SYN/FIN/RST/URG */
+	if ((tcp_hdr_ptr[13] & 0x37) != 0x10)
+		return;
+	data_offset = (tcp_hdr_ptr[12] & 0xf0) >> 2;
+
+	memset(&key, 0, sizeof(key));
+	if (tqe->l3_proto == ETH_P_IP) {
+		l3_len = ((u32)ip_hdr_ptr[2] << 8) + (u32)ip_hdr_ptr[3];
+		if (l3_len != tqe->th_offset - tqe->nh_offset + data_offset)
+			return;
+		memcpy(&key.saddr[0], &ip_hdr_ptr[12], 4);
+		memcpy(&key.daddr[0], &ip_hdr_ptr[16], 4);
+	} else if (tqe->l3_proto == ETH_P_IPV6) {
+		l3_len = ((u32)ip_hdr_ptr[4] << 8) + (u32)ip_hdr_ptr[5];
+		if (l3_len != data_offset)
+			return;
+		memcpy(key.saddr, &ip_hdr_ptr[8], 16);
+		memcpy(key.daddr, &ip_hdr_ptr[24], 16);
+	} else {
+		return;
+	}
+
+	f->win_acks++;
+	if (!f->enabled)
+		return;
+
+	memcpy(&key.sport, &tcp_hdr_ptr[0], 2);
+	memcpy(&key.dport, &tcp_hdr_ptr[2], 2);
+	key.l3_proto = tqe->l3_proto;
+
+	ack_no = ((u32)tcp_hdr_ptr[8] << 24) +
+		 ((u32)tcp_hdr_ptr[9] << 16) +
+		 ((u32)tcp_hdr_ptr[10] << 8) +
+		 (u32)tcp_hdr_ptr[11];
+
+	hash = jhash2((u32 *)&key, sizeof(key) / sizeof(u32), 0) &
+	       (WILC_ACK_HASH_SIZE - 1);
+	hlist_for_each_entry(s, &f->hash[hash], node)
+		if (!memcmp(&s->key, &key, sizeof(key)))
+			break;
+
+	if (!s) {
+		if (hlist_empty(&f->free)) {
+			f->untracked++;
+			return;
+		}
+		s = hlist_entry(f->free.first, struct tcp_ack_session, node);
+		hlist_del(&s->node);
+		s->key = key;
+		s->bigger_ack_num = ack_no;
+		s->pending = 0;
+		hlist_add_head(&s->node, &f->hash[hash]);
+		f->sessions++;
+	} else if (tcp_ack_before(s->bigger_ack_num, ack_no)) {
+		s->bigger_ack_num = ack_no;
+	}
+
+	s->pending++;
+	tqe->ack_session = s;
+	tqe->ack_num = ack_no;
+	list_add_tail(&tqe->ack_list, &f->pending);
+}
+
 static void wilc_wlan_txq_remove(struct wilc *wilc, u8 q_num,
 				 struct txq_entry_t *tqe)
 {
+	tcp_ack_release(wilc, tqe);
 	if (tqe == wilc->txq[q_num].txq_head) {
 		wilc->txq[q_num].txq_head = tqe->next;
 		if (wilc->txq[q_num].txq_head)
@@ -50,6 +321,7 @@ static void wilc_wlan_txq_remove(struct wilc *wilc, u8 q_num,
 	}
 	wilc->txq_entries -= 1;
 	wilc->txq[q_num].count--;
+	wilc->txq[q_num].bytes -= tqe->buffer_size;
 }
 
 static struct txq_entry_t *
@@ -70,8 +342,10 @@ wilc_wlan_txq_remove_from_head(struct net_device *dev, u8 q_num)
 		if (wilc->txq[q_num].txq_head)
 			wilc->txq[q_num].txq_head->prev = NULL;
 
+		tcp_ack_release(wilc, tqe);
 		wilc->txq_entries -= 1;
 		wilc->txq[q_num].count--;
+		wilc->txq[q_num].bytes -= tqe->buffer_size;
 	} else {
 		tqe = NULL;
 	}
@@ -79,18 +353,10 @@ wilc_wlan_txq_remove_from_head(struct net_device *dev, u8 q_num)
 	return tqe;
 }
 
-static void wilc_wlan_txq_add_to_tail(struct net_device *dev, u8 q_num,
-				      struct txq_entry_t *tqe)
+/* Called with txq_spinlock held */
+static void __wilc_wlan_txq_add_to_tail(struct wilc *wilc, u8 q_num,
+					struct txq_entry_t *tqe)
 {
-	unsigned long flags;
-	struct wilc_vif *vif;
-	struct wilc *wilc;
-
-	vif = netdev_priv(dev);
-	wilc = vif->wilc;
-
-	spin_lock_irqsave(&wilc->txq_spinlock, flags);
-
 	if (!wilc->txq[q_num].txq_head) {
 		tqe->next = NULL;
 		tqe->prev = NULL;
@@ -104,13 +370,40 @@ static void wilc_wlan_txq_add_to_tail(struct net_device *dev, u8 q_num,
 	}
 	wilc->txq_entries += 1;
 	wilc->txq[q_num].count++;
+	wilc->txq[q_num].bytes += tqe->buffer_size;
+	if (tqe->type == WILC_NET_PKT)
+		tcp_process(wilc, tqe);
+}
+
+/* Flag TX work and wake the TX thread unless it was flagged already, in which
+ * case the thread is running or about to and will see the new frame.
+ */
+void wilc_wlan_txq_kick(struct wilc *wilc)
+{
+	if (!test_and_set_bit(WILC_TXQ_WORK, &wilc->txq_flags))
+		wake_up_interruptible(&wilc->txq_wq);
+}
+
+static void wilc_wlan_txq_add_to_tail(struct net_device *dev, u8 q_num,
+				      struct txq_entry_t *tqe)
+{
+	unsigned long flags;
+	struct wilc_vif *vif;
+	struct wilc *wilc;
+
+	vif = netdev_priv(dev);
+	wilc = vif->wilc;
+
+	spin_lock_irqsave(&wilc->txq_spinlock, flags);
+	tqe->enq_time = jiffies;
+	__wilc_wlan_txq_add_to_tail(wilc, q_num, tqe);
 	PRINT_INFO(vif->ndev, TX_DBG, "Number of entries in TxQ = %d\n",
 		   wilc->txq_entries);
 
 	spin_unlock_irqrestore(&wilc->txq_spinlock, flags);
 
 	PRINT_INFO(vif->ndev, TX_DBG, "Wake the txq_handling\n");
-	complete(&wilc->txq_event);
+	wilc_wlan_txq_kick(wilc);
 }
 
 static int wilc_wlan_txq_add_to_head(struct wilc_vif *vif, u8 q_num,
@@ -134,218 +427,57 @@ static int wilc_wlan_txq_add_to_head(struct wilc_vif *vif, u8 q_num,
 		wilc->txq[q_num].txq_head->prev = tqe;
 		wilc->txq[q_num].txq_head = tqe;
 	}
+	tqe->enq_time = jiffies;
 	wilc->txq_entries += 1;
 	wilc->txq[q_num].count++;
+	wilc->txq[q_num].bytes += tqe->buffer_size;
 	PRINT_INFO(vif->ndev, TX_DBG,"Number of entries in TxQ = %d\n",wilc->txq_entries);
 
 	spin_unlock_irqrestore(&wilc->txq_spinlock, flags);
 	mutex_unlock(&wilc->txq_add_to_head_cs);
-	complete(&wilc->txq_event);
+	wilc_wlan_txq_kick(wilc);
 	PRINT_INFO(vif->ndev, TX_DBG, "Wake up the txq_handler\n");
 
 	return 0;
 }
 
-struct ack_session_info;
-struct ack_session_info {
-	u32 seq_num;
-	u32 bigger_ack_num;
-	u16 src_port;
-	u16 dst_port;
-	u16 status;
-};
-
-struct pending_acks_info {
-	u32 ack_num;
-	u32 session_index;
-	struct txq_entry_t  *txqe;
-};
-
-#define NOT_TCP_ACK			(-1)
-
-#define MAX_TCP_SESSION		25
-#define MAX_PENDING_ACKS		256
-static struct ack_session_info ack_session_info[2 * MAX_TCP_SESSION];
-static struct pending_acks_info pending_acks_info[MAX_PENDING_ACKS];
-
-static u32 pending_base;
-static u32 tcp_session;
-static u32 pending_acks;
-
-static inline int add_tcp_session(struct wilc_vif *vif, u32 src_prt,
-				  u32 dst_prt, u32 seq)
-{
-	if (tcp_session < 2 * MAX_TCP_SESSION) {
-		ack_session_info[tcp_session].seq_num = seq;
-		ack_session_info[tcp_session].bigger_ack_num = 0;
-		ack_session_info[tcp_session].src_port = src_prt;
-		ack_session_info[tcp_session].dst_port = dst_prt;
-		tcp_session++;
-		PRINT_INFO(vif->ndev, TCP_ENH, "TCP Session %d to Ack %d\n",
-			   tcp_session, seq);
-	}
-	return 0;
-}
-
-static inline int update_tcp_session(struct wilc_vif *vif, u32 index, u32 ack)
-{
-	if (index < 2 * MAX_TCP_SESSION &&
-	    ack > ack_session_info[index].bigger_ack_num)
-		ack_session_info[index].bigger_ack_num = ack;
-	return 0;
-}
-
-static inline int add_tcp_pending_ack(struct wilc_vif *vif, u32 ack,
-				      u32 session_index,
-				      struct txq_entry_t *txqe)
-{
-	u32 i = pending_base + pending_acks;
-
-	if (i < MAX_PENDING_ACKS) {
-		pending_acks_info[i].ack_num = ack;
-		pending_acks_info[i].txqe = txqe;
-		pending_acks_info[i].session_index = session_index;
-		txqe->tcp_pending_ack_idx = i;
-		pending_acks++;
-	}
-	return 0;
-}
-
-static inline void tcp_process(struct net_device *dev, struct txq_entry_t *tqe)
-{
-	u8 *eth_hdr_ptr;
-	u8 *buffer = tqe->buffer;
-	unsigned short h_proto;
-	int i;
-	unsigned long flags;
-	struct wilc_vif *vif;
-	struct wilc *wilc;
-
-	vif = netdev_priv(dev);
-	wilc = vif->wilc;
-
-	spin_lock_irqsave(&wilc->txq_spinlock, flags);
-
-	eth_hdr_ptr = &buffer[0];
-	h_proto = ntohs(*((unsigned short *)&eth_hdr_ptr[12]));
-	if (h_proto == ETH_P_IP) {
-		u8 *ip_hdr_ptr;
-		u8 protocol;
-
-		ip_hdr_ptr = &buffer[ETHERNET_HDR_LEN];
-		protocol = ip_hdr_ptr[9];
-
-		if (protocol == 0x06) {
-			u8 *tcp_hdr_ptr;
-			u32 IHL, total_length, data_offset;
-
-			tcp_hdr_ptr = &ip_hdr_ptr[IP_HDR_LEN];
-			IHL = (ip_hdr_ptr[0] & 0xf) << 2;
-			total_length = ((u32)ip_hdr_ptr[2] << 8) +
-					(u32)ip_hdr_ptr[3];
-			data_offset = ((u32)tcp_hdr_ptr[12] & 0xf0) >> 2;
-			if (total_length == (IHL + data_offset)) {
-				u32 seq_no, ack_no;
-
-				seq_no = ((u32)tcp_hdr_ptr[4] << 24) +
-					 ((u32)tcp_hdr_ptr[5] << 16) +
-					 ((u32)tcp_hdr_ptr[6] << 8) +
-					 (u32)tcp_hdr_ptr[7];
-
-				ack_no = ((u32)tcp_hdr_ptr[8] << 24) +
-					 ((u32)tcp_hdr_ptr[9] << 16) +
-					 ((u32)tcp_hdr_ptr[10] << 8) +
-					 (u32)tcp_hdr_ptr[11];
-
-				for (i = 0; i < tcp_session; i++) {
-					u32 j = ack_session_info[i].seq_num;
-
-					if (i < 2 * MAX_TCP_SESSION &&
-					    j == seq_no) {
-						update_tcp_session(vif, i,
-								   ack_no);
-						break;
-					}
-				}
-				if (i == tcp_session)
-					add_tcp_session(vif, 0, 0, seq_no);
-
-				add_tcp_pending_ack(vif, ack_no, i, tqe);
-			}
-		}
-	}
-	spin_unlock_irqrestore(&wilc->txq_spinlock, flags);
-}
-
 static int wilc_wlan_txq_filter_dup_tcp_ack(struct net_device *dev)
 {
 	struct wilc_vif *vif;
 	struct wilc *wilc;
-	u32 i = 0;
+	struct txq_entry_t *tqe, *tmp;
+	LIST_HEAD(drop_list);
+	unsigned long flags;
 	u32 dropped = 0;
 
 	vif = netdev_priv(dev);
 	wilc = vif->wilc;
 
-	spin_lock_irqsave(&wilc->txq_spinlock, wilc->txq_spinlock_flags);
-	for (i = pending_base; i < (pending_base + pending_acks); i++) {
-		u32 session_index;
-		u32 bigger_ack_num;
-
-		if (i >= MAX_PENDING_ACKS)
-			break;
-
-		session_index = pending_acks_info[i].session_index;
-
-		if (session_index >= 2 * MAX_TCP_SESSION)
-			break;
-
-		bigger_ack_num = ack_session_info[session_index].bigger_ack_num;
-
-		if (pending_acks_info[i].ack_num < bigger_ack_num) {
-			struct txq_entry_t *tqe;
-
-			PRINT_INFO(vif->ndev, TCP_ENH, "DROP ACK: %u\n",
-				   pending_acks_info[i].ack_num);
-			tqe = pending_acks_info[i].txqe;
-			if (tqe) {
-				wilc_wlan_txq_remove(wilc, tqe->q_num, tqe);
-				tqe->status = 1;
-				if (tqe->tx_complete_func)
-					tqe->tx_complete_func(tqe->priv,
-							      tqe->status);
-				kfree(tqe);
-				dropped++;
-			}
-		}
-	}
-	pending_acks = 0;
-	tcp_session = 0;
-
-	if (pending_base == 0)
-		pending_base = MAX_TCP_SESSION;
-	else
-		pending_base = 0;
-
-	spin_unlock_irqrestore(&wilc->txq_spinlock, wilc->txq_spinlock_flags);
+	spin_lock_irqsave(&wilc->txq_spinlock, flags);
+	list_for_each_entry_safe(tqe, tmp, &wilc->ack_filter.pending,
+				 ack_list) {
+		if (!tcp_ack_before(tqe->ack_num,
+				    tqe->ack_session->bigger_ack_num))
+			continue;
+
+		PRINT_INFO(vif->ndev, TCP_ENH, "DROP ACK: %u\n", tqe->ack_num);
+		wilc_wlan_txq_remove(wilc, tqe->q_num, tqe);
+		list_add_tail(&tqe->ack_list, &drop_list);
+		dropped++;
+	}
+	wilc->ack_filter.dropped += dropped;
+	spin_unlock_irqrestore(&wilc->txq_spinlock, flags);
 
-	while (dropped > 0) {
-		if(!wait_for_completion_timeout(&wilc->txq_event,
-						msecs_to_jiffies(1)))
-			PRINT_ER(vif->ndev, "completion timedout\n");
-		dropped--;
+	list_for_each_entry_safe(tqe, tmp, &drop_list, ack_list) {
+		tqe->status = 1;
+		if (tqe->tx_complete_func)
+			tqe->tx_complete_func(tqe->priv, tqe->status);
+		kfree(tqe);
 	}
 
 	return 1;
 }
 
-static bool ack_filter_enabled;
-
-void wilc_enable_tcp_ack_filter(bool value)
-{
-	ack_filter_enabled = value;
-}
-
 static int wilc_wlan_txq_add_cfg_pkt(struct wilc_vif *vif, u8 *buffer,
 				     u32 buffer_size)
 {
@@ -374,13 +506,13 @@ static int wilc_wlan_txq_add_cfg_pkt(struct wilc_vif *vif, u8 *buffer,
 	tqe->buffer_size = buffer_size;
 	tqe->tx_complete_func = NULL;
 	tqe->priv = NULL;
-	tqe->q_num = AC_VO_Q;
-	tqe->tcp_pending_ack_idx = NOT_TCP_ACK;
+	tqe->q_num = WILC_CTRL_Q;
+	tqe->ack_session = NULL;
 
 	PRINT_INFO(vif->ndev, TX_DBG,
-		   "Adding the config packet at the Queue tail\n");
+		   "Adding the config packet at the Queue head\n");
 
-	if (wilc_wlan_txq_add_to_head(vif, AC_VO_Q, tqe)) {
+	if (wilc_wlan_txq_add_to_head(vif, WILC_CTRL_Q, tqe)) {
 		complete(&wilc->cfg_event);
 		kfree(tqe);
 		return 0;
@@ -389,98 +521,217 @@ static int wilc_wlan_txq_add_cfg_pkt(struct wilc_vif *vif, u8 *buffer,
 	return 1;
 }
 
-static void ac_q_limit(struct wilc *wilc, u8 ac, u16 *q_limit)
+static void txq_est_set_limits(struct wilc *wilc)
 {
-	static u8 buffer[AC_BUFFER_SIZE];
-	static u16 end_index;
-	static bool initialized;
-	static u16 cnt[NQUEUES];
-	u8 factors[NQUEUES] = {1, 1, 1, 1};
-	static u16 sum;
-	u16 i;
-
-	spin_lock_irqsave(&wilc->txq_spinlock, wilc->txq_spinlock_flags);
-	if (!initialized) {
-		for (i = 0; i < AC_BUFFER_SIZE; i++)
-			buffer[i] = i % NQUEUES;
+	struct wilc_txq_est *e = &wilc->txq_est;
+	u32 sum_pkts = 0, sum_bytes = 0;
+	int ac;
 
-		for (i = 0; i < NQUEUES; i++) {
-			cnt[i] = AC_BUFFER_SIZE * factors[i] / NQUEUES;
-			sum += cnt[i];
-		}
-		end_index = AC_BUFFER_SIZE - 1;
-		initialized = 1;
+	for (ac = 0; ac < NQUEUES; ac++) {
+		sum_pkts += e->avg_pkts[ac];
+		sum_bytes += e->avg_bytes[ac];
 	}
 
-	cnt[buffer[end_index]] -= factors[buffer[end_index]];
-	cnt[ac] += factors[ac];
-	sum += (factors[ac] - factors[buffer[end_index]]);
-
-	buffer[end_index] = ac;
-	if (end_index > 0)
-		end_index--;
-	else
-		end_index = AC_BUFFER_SIZE - 1;
+	for (ac = 0; ac < NQUEUES; ac++) {
+		if (!sum_pkts)
+			e->pkt_limit[ac] = wilc->fc_upper / NQUEUES;
+		else
+			e->pkt_limit[ac] = e->avg_pkts[ac] * wilc->fc_upper /
+					   sum_pkts;
+		e->pkt_limit[ac] += 1;
 
-	for (i = 0; i < NQUEUES; i++){
-		if(!sum)
-			q_limit[i] = 1;
+		if (!sum_bytes)
+			e->byte_limit[ac] = tx_byte_limit / NQUEUES;
 		else
-			q_limit[i] = (cnt[i] * FLOW_CONTROL_UPPER_THRESHOLD / sum) + 1;
+			e->byte_limit[ac] = div_u64((u64)e->avg_bytes[ac] *
+						    tx_byte_limit, sum_bytes);
+		e->byte_limit[ac] += TXQ_EST_MIN_BYTES;
 	}
-	spin_unlock_irqrestore(&wilc->txq_spinlock, wilc->txq_spinlock_flags);
-	return;
 }
 
-static inline u8 ac_classify(struct wilc *wilc, struct txq_entry_t *tqe)
+static void wilc_wlan_txq_est_init(struct wilc *wilc)
 {
-	u8 *eth_hdr_ptr;
-	u8 *buffer = tqe->buffer;
-	u8 ac;
-	u16 h_proto;
+	memset(&wilc->txq_est, 0, sizeof(wilc->txq_est));
+	wilc->txq_est.win_start = jiffies;
+	txq_est_set_limits(wilc);
+}
 
-	spin_lock_irqsave(&wilc->txq_spinlock, wilc->txq_spinlock_flags);
+/* Fold the closed window into the averages. Windows that passed with no
+ * traffic at all only decay them. Called with txq_spinlock held.
+ */
+static void txq_est_fold(struct wilc *wilc)
+{
+	struct wilc_txq_est *e = &wilc->txq_est;
+	unsigned long window = msecs_to_jiffies(TXQ_EST_WINDOW_MS);
+	unsigned long idle;
+	int ac;
 
-	eth_hdr_ptr = &buffer[0];
-	h_proto = ntohs(*((unsigned short *)&eth_hdr_ptr[12]));
-	if (h_proto == ETH_P_IP) {
-		u8 *ip_hdr_ptr;
-		u32 IHL, DSCP;
+	if (time_before(jiffies, e->win_start + window))
+		return;
 
-		ip_hdr_ptr = &buffer[ETHERNET_HDR_LEN];
-		IHL = (ip_hdr_ptr[0] & 0xf) << 2;
-		DSCP = (ip_hdr_ptr[1] & 0xfc);
+	idle = min((jiffies - e->win_start) / window - 1, 16UL);
+	for (ac = 0; ac < NQUEUES; ac++) {
+		e->avg_pkts[ac] += ((e->win_pkts[ac] << TXQ_EST_FRAC) >>
+				    TXQ_EST_WEIGHT) -
+				   (e->avg_pkts[ac] >> TXQ_EST_WEIGHT);
+		e->avg_bytes[ac] += ((e->win_bytes[ac] << TXQ_EST_FRAC) >>
+				     TXQ_EST_WEIGHT) -
+				    (e->avg_bytes[ac] >> TXQ_EST_WEIGHT);
+		e->avg_pkts[ac] >>= idle;
+		e->avg_bytes[ac] >>= idle;
+		e->win_pkts[ac] = 0;
+		e->win_bytes[ac] = 0;
+	}
+	e->win_start = jiffies;
+	txq_est_set_limits(wilc);
+}
 
-		switch (DSCP) {
-		case 0x20:
-		case 0x40:
-		case 0x08:
-			ac = AC_BK_Q;
-			break;
-		case 0x80:
-		case 0xA0:
-		case 0x28:
-			ac = AC_VI_Q;
-			break;
-		case 0xC0:
-		case 0xd0:
-		case 0xE0:
-		case 0x88:
-		case 0xB8:
-			ac = AC_VO_Q;
-			break;
-		default:
-			ac = AC_BE_Q;
-			break;
+/* Account a data frame for its AC and tell whether the queue has room for
+ * it under both the packet and the byte limit. Called with txq_spinlock
+ * held.
+ */
+static bool txq_est_admit(struct wilc *wilc, u8 ac, u32 size)
+{
+	struct wilc_txq_est *e = &wilc->txq_est;
+
+	e->win_pkts[ac]++;
+	e->win_bytes[ac] += size;
+	txq_est_fold(wilc);
+
+	return wilc->txq[ac].count <= e->pkt_limit[ac] &&
+	       wilc->txq[ac].bytes + size <= e->byte_limit[ac];
+}
+
+/* Park a data frame on the staging list without taking a lock. Only the
+ * first frame on an empty list wakes the TX thread, which takes the whole
+ * list in one go.
+ */
+static void wilc_wlan_txq_stage(struct wilc *wilc, struct txq_entry_t *tqe)
+{
+	tqe->next = NULL;
+	tqe->enq_time = jiffies;
+
+	atomic_inc(&wilc->tx_staged);
+	if (llist_add(&tqe->stage_node, &wilc->tx_stage))
+		wilc_wlan_txq_kick(wilc);
+}
+
+/* Detach the staged frames into a chain in the order they were staged, so
+ * a flow sent from several CPUs keeps its order.
+ */
+static struct txq_entry_t *wilc_wlan_txq_take_staged(struct wilc *wilc)
+{
+	struct txq_entry_t *tqe, *head = NULL, **link = &head;
+	struct llist_node *node;
+
+	node = llist_reverse_order(llist_del_all(&wilc->tx_stage));
+	llist_for_each_entry(tqe, node, stage_node) {
+		*link = tqe;
+		link = &tqe->next;
+	}
+
+	return head;
+}
+
+/* Move all staged data frames to their AC queues under a single hold of
+ * txq_spinlock. Frames over their AC's limits are completed as dropped.
+ */
+static void wilc_wlan_txq_splice_staged(struct wilc *wilc)
+{
+	struct txq_entry_t *tqe, *next, *drop = NULL;
+	unsigned long flags;
+	int n = 0;
+
+	tqe = wilc_wlan_txq_take_staged(wilc);
+	if (!tqe)
+		return;
+
+	spin_lock_irqsave(&wilc->txq_spinlock, flags);
+	for (; tqe; tqe = next) {
+		next = tqe->next;
+		n++;
+		if (txq_est_admit(wilc, tqe->q_num, tqe->buffer_size)) {
+			tqe->ack_session = NULL;
+			__wilc_wlan_txq_add_to_tail(wilc, tqe->q_num, tqe);
+		} else {
+			tqe->next = drop;
+			drop = tqe;
 		}
-	} else {
-		ac  = AC_BE_Q;
 	}
+	atomic_sub(n, &wilc->tx_staged);
+	spin_unlock_irqrestore(&wilc->txq_spinlock, flags);
 
-	tqe->q_num = ac;
-	spin_unlock_irqrestore(&wilc->txq_spinlock, wilc->txq_spinlock_flags);
+	for (tqe = drop; tqe; tqe = next) {
+		next = tqe->next;
+		tqe->status = 0;
+		if (tqe->tx_complete_func)
+			tqe->tx_complete_func(tqe->priv, tqe->status);
+		kfree(tqe);
+	}
+}
 
-	return ac;
+/* Pick the AC of a data frame and record where its IP and transport headers
+ * start, so later stages such as the TCP ACK filter don't parse it again.
+ * An explicit 802.11 priority in skb->priority (256..263) wins, then a
+ * non-zero VLAN PCP, then a non-zero DSCP, then the socket priority.
+ */
+static u8 ac_classify(struct wilc *wilc, struct txq_entry_t *tqe)
+{
+	struct tx_complete_data *tx_data = tqe->priv;
+	u32 priority = tx_data->skb->priority;
+	u8 *buffer = tqe->buffer;
+	u32 size = tqe->buffer_size;
+	u32 offset = ETH_HLEN;
+	u16 h_proto;
+	u8 pcp = 0, dscp = 0;
+
+	tqe->l3_proto = 0;
+	tqe->nh_offset = 0;
+	tqe->th_offset = 0;
+	tqe->ip_proto = 0;
+
+	if (size < ETH_HLEN)
+		return AC_BE_Q;
+
+	h_proto = ntohs(*((__be16 *)&buffer[12]));
+	if (h_proto == ETH_P_8021Q && size >= VLAN_ETH_HLEN) {
+		pcp = buffer[14] >> 5;
+		h_proto = ntohs(*((__be16 *)&buffer[16]));
+		offset = VLAN_ETH_HLEN;
+	}
+
+	if (h_proto == ETH_P_IP && size >= offset + sizeof(struct iphdr)) {
+		u8 *ip_hdr_ptr = &buffer[offset];
+		u32 ihl = (ip_hdr_ptr[0] & 0xf) << 2;
+
+		dscp = ip_hdr_ptr[1] >> 2;
+		tqe->l3_proto = ETH_P_IP;
+		tqe->nh_offset = offset;
+		tqe->ip_proto = ip_hdr_ptr[9];
+		if (ihl >= sizeof(struct iphdr) && size > offset + ihl)
+			tqe->th_offset = offset + ihl;
+	} else if (h_proto == ETH_P_IPV6 &&
+		   size >= offset + sizeof(struct ipv6hdr)) {
+		u8 *ip_hdr_ptr = &buffer[offset];
+
+		dscp = (((ip_hdr_ptr[0] & 0x0f) << 4) | (ip_hdr_ptr[1] >> 4)) >> 2;
+		tqe->l3_proto = ETH_P_IPV6;
+		tqe->nh_offset = offset;
+		tqe->ip_proto = ip_hdr_ptr[6];
+		if (size > offset + sizeof(struct ipv6hdr))
+			tqe->th_offset = offset + sizeof(struct ipv6hdr);
+	}
+
+	if (priority >= 256 && priority <= 263)
+		return up_to_ac[priority - 256];
+	if (pcp)
+		return up_to_ac[pcp];
+	if (dscp)
+		return dscp_to_ac[dscp] & 0x3;
+	if (priority > 0 && priority < 8)
+		return up_to_ac[priority];
+
+	return AC_BE_Q;
 }
 
 static inline int ac_balance(u8 *count, u8 *ratio)
@@ -533,7 +784,6 @@ int wilc_wlan_txq_add_net_pkt(struct net_device *dev, void *priv, u8 *buffer,
 	struct wilc_vif *vif = netdev_priv(dev);
 	struct wilc *wilc;
 	u8 q_num;
-	u16 q_limit[NQUEUES] = {0, 0, 0, 0};
 
 	if(!vif){
 		pr_info("%s vif is NULL\n", __func__);
@@ -556,7 +806,7 @@ int wilc_wlan_txq_add_net_pkt(struct net_device *dev, void *priv, u8 *buffer,
 		return 0;
 	}
 
-	tqe = kmalloc(sizeof(*tqe), GFP_KERNEL);
+	tqe = kmalloc(sizeof(*tqe), GFP_ATOMIC);
 
 	if (!tqe) {
 		PRINT_INFO(vif->ndev, TX_DBG,
@@ -570,33 +820,23 @@ int wilc_wlan_txq_add_net_pkt(struct net_device *dev, void *priv, u8 *buffer,
 	tqe->tx_complete_func = func;
 	tqe->priv = priv;
 
+	/* Downgrade to the next AC that the AP doesn't put under admission
+	 * control, as reported by the firmware in WILC_HOST_TX_CTRL.
+	 */
 	q_num = ac_classify(wilc, tqe);
 	if (ac_change(wilc, &q_num)) {
 		PRINT_INFO(vif->ndev, GENERIC_DBG,
 			   "No suitable non-ACM queue\n");
+		func(priv, 0);
 		kfree(tqe);
 		return 0;
 	}
-	ac_q_limit(wilc, q_num, q_limit);
+	tqe->q_num = q_num;
 
-	if ((q_num == AC_VO_Q && wilc->txq[q_num].count <= q_limit[AC_VO_Q]) ||
-	    (q_num == AC_VI_Q && wilc->txq[q_num].count <= q_limit[AC_VI_Q]) ||
-	    (q_num == AC_BE_Q && wilc->txq[q_num].count <= q_limit[AC_BE_Q]) ||
-	    (q_num == AC_BK_Q && wilc->txq[q_num].count <= q_limit[AC_BK_Q])) {
-		PRINT_INFO(vif->ndev, TX_DBG,
-			   "Adding mgmt packet at the Queue tail\n");
-		tqe->tcp_pending_ack_idx = NOT_TCP_ACK;
-		if (ack_filter_enabled)
-			tcp_process(dev, tqe);
-		wilc_wlan_txq_add_to_tail(dev, q_num, tqe);
-	} else {
-		tqe->status = 0;
-		if (tqe->tx_complete_func)
-			tqe->tx_complete_func(tqe->priv, tqe->status);
-		kfree(tqe);
-	}
+	PRINT_INFO(vif->ndev, TX_DBG, "Staging data packet\n");
+	wilc_wlan_txq_stage(wilc, tqe);
 
-	return wilc->txq_entries;
+	return wilc->txq_entries + atomic_read(&wilc->tx_staged);
 }
 
 int wilc_wlan_txq_add_mgmt_pkt(struct net_device *dev, void *priv, u8 *buffer,
@@ -631,11 +871,11 @@ int wilc_wlan_txq_add_mgmt_pkt(struct net_device *dev, void *priv, u8 *buffer,
 	tqe->buffer_size = buffer_size;
 	tqe->tx_complete_func = func;
 	tqe->priv = priv;
-	tqe->q_num = AC_BE_Q;
-	tqe->tcp_pending_ack_idx = NOT_TCP_ACK;
+	tqe->q_num = WILC_CTRL_Q;
+	tqe->ack_session = NULL;
 
 	PRINT_INFO(vif->ndev, TX_DBG, "Adding Mgmt packet to Queue tail\n");
-	wilc_wlan_txq_add_to_tail(dev, AC_BE_Q, tqe);
+	wilc_wlan_txq_add_to_tail(dev, WILC_CTRL_Q, tqe);
 	return 1;
 }
 
@@ -666,50 +906,54 @@ static struct txq_entry_t *wilc_wlan_txq_get_next(struct wilc *wilc,
 	return tqe;
 }
 
-static int wilc_wlan_rxq_add(struct wilc *wilc, struct rxq_entry_t *rqe)
+static inline bool wilc_wlan_txq_expired(struct txq_entry_t *tqe)
 {
-	struct wilc_vif *vif = wilc->vif[0];
-	
-	if (wilc->quit)
-		return 0;
+	unsigned int deadline;
 
-	mutex_lock(&wilc->rxq_cs);
-	if (!wilc->rxq_head) {
-		PRINT_INFO(vif->ndev, RX_DBG,"Add to Queue head\n");
-		rqe->next = NULL;
-		wilc->rxq_head = rqe;
-		wilc->rxq_tail = rqe;
-	} else {
-		PRINT_INFO(vif->ndev, RX_DBG,"Add to Queue tail\n");
-		wilc->rxq_tail->next = rqe;
-		rqe->next = NULL;
-		wilc->rxq_tail = rqe;
-	}
-	wilc->rxq_entries += 1;
-	PRINT_INFO(vif->ndev, RX_DBG,"Number of queue entries: %d\n",
-		   wilc->rxq_entries);
-	mutex_unlock(&wilc->rxq_cs);
-	return wilc->rxq_entries;
+	if (tqe->type != WILC_NET_PKT)
+		return false;
+
+	deadline = tx_deadline_ms[tqe->q_num];
+	if (!deadline)
+		return false;
+
+	return time_after(jiffies, tqe->enq_time + msecs_to_jiffies(deadline));
 }
 
-static struct rxq_entry_t *wilc_wlan_rxq_remove(struct wilc *wilc)
+/* Drop frames that outlived their AC deadline, starting at tqe, and return
+ * the first one still worth sending.
+ */
+static struct txq_entry_t *wilc_wlan_txq_drop_aged(struct wilc *wilc,
+						   struct txq_entry_t *tqe)
 {
-	struct wilc_vif *vif = wilc->vif[0];
-	
-	PRINT_INFO(vif->ndev, RX_DBG,"Getting rxQ element\n");
-	if (wilc->rxq_head) {
-		struct rxq_entry_t *rqe;
+	struct txq_entry_t *next;
+	struct tx_complete_data *tx_data;
+	struct wilc_vif_stats *stats;
+	unsigned long flags;
 
-		mutex_lock(&wilc->rxq_cs);
-		rqe = wilc->rxq_head;
-		wilc->rxq_head = wilc->rxq_head->next;
-		wilc->rxq_entries -= 1;
-		PRINT_INFO(vif->ndev, RX_DBG,"RXQ entries decreased\n");
-		mutex_unlock(&wilc->rxq_cs);
-		return rqe;
+	while (tqe && wilc_wlan_txq_expired(tqe)) {
+		spin_lock_irqsave(&wilc->txq_spinlock, flags);
+		next = tqe->next;
+		wilc_wlan_txq_remove(wilc, tqe->q_num, tqe);
+		wilc->txq[tqe->q_num].aged_out++;
+		spin_unlock_irqrestore(&wilc->txq_spinlock, flags);
+
+		tx_data = tqe->priv;
+		local_bh_disable();
+		stats = this_cpu_ptr(tx_data->vif->stats);
+		u64_stats_update_begin(&stats->syncp);
+		stats->tx_dropped++;
+		u64_stats_update_end(&stats->syncp);
+		local_bh_enable();
+		PRINT_INFO(tx_data->vif->ndev, TX_DBG,
+			   "Frame aged out of AC %d\n", tqe->q_num);
+		if (tqe->tx_complete_func)
+			tqe->tx_complete_func(tqe->priv, 0);
+		kfree(tqe);
+		tqe = next;
 	}
-	PRINT_INFO(vif->ndev, RX_DBG,"Nothing to get from Q\n");
-	return NULL;
+
+	return tqe;
 }
 
 void chip_allow_sleep(struct wilc *wilc, int source)
@@ -960,6 +1204,65 @@ void host_sleep_notify(struct wilc *wilc, int source)
 	release_bus(wilc, RELEASE_ONLY,source);
 }
 
+/* Reserve the next VMM table slot for tqe from queue q. Returns false once
+ * the table or the TX buffer is full.
+ */
+static bool wilc_wlan_vmm_add(struct wilc_vif *vif, struct txq_entry_t *tqe,
+			      u8 q, u32 *vmm_table, u8 *vmm_entries_ac,
+			      int *i, u32 *sum)
+{
+	int vmm_sz;
+
+	if (*i >= vif->wilc->vmm_batch)
+		return false;
+
+	if (tqe->type == WILC_CFG_PKT)
+		vmm_sz = ETH_CONFIG_PKT_HDR_OFFSET;
+	else if (tqe->type == WILC_NET_PKT)
+		vmm_sz = ETH_ETHERNET_HDR_OFFSET;
+	else
+		vmm_sz = HOST_HDR_OFFSET;
+
+	vmm_sz += tqe->buffer_size;
+	PRINT_INFO(vif->ndev, TX_DBG,"VMM Size before alignment = %d\n",vmm_sz);
+	if (vmm_sz & 0x3)
+		vmm_sz = (vmm_sz + 4) & ~0x3;
+
+	if ((*sum + vmm_sz) > vif->wilc->tx_buf_size)
+		return false;
+
+	PRINT_INFO(vif->ndev, TX_DBG,"VMM Size AFTER alignment = %d\n",vmm_sz);
+	vmm_table[*i] = vmm_sz / 4;
+	PRINT_INFO(vif->ndev, TX_DBG,"VMMTable entry size = %d\n",vmm_table[*i]);
+	if (tqe->type == WILC_CFG_PKT) {
+		vmm_table[*i] |= BIT(10);
+		PRINT_INFO(vif->ndev, TX_DBG,"VMMTable entry changed for CFG packet = %d\n",vmm_table[*i]);
+	}
+	vmm_table[*i] = cpu_to_le32(vmm_table[*i]);
+	vmm_entries_ac[*i] = q;
+
+	(*i)++;
+	*sum += vmm_sz;
+	PRINT_INFO(vif->ndev, TX_DBG,"sum = %d\n",*sum);
+
+	return true;
+}
+
+/* Shrink the batch limit when a transfer held the bus longer than the
+ * target, grow it while batches keep filling up within it.
+ */
+static void wilc_wlan_tx_autotune(struct wilc *wilc, int batch)
+{
+	u16 limit = clamp_t(u32, tx_vmm_batch, TX_AUTOTUNE_MIN_BATCH,
+			    WILC_VMM_TBL_SIZE - 1);
+
+	if (wilc->tx_xfer_us > tx_autotune_us)
+		wilc->vmm_batch = max_t(u16, wilc->vmm_batch * 3 / 4,
+					TX_AUTOTUNE_MIN_BATCH);
+	else if (batch >= wilc->vmm_batch)
+		wilc->vmm_batch = min_t(u16, wilc->vmm_batch + 4, limit);
+}
+
 static u8 ac_fw_count[NQUEUES] = {0, 0, 0, 0};
 int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 {
@@ -976,11 +1279,14 @@ int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 	bool max_size_over = 0, ac_exist = 0;
 	int vmm_sz = 0;
 	struct txq_entry_t *tqe_q[NQUEUES];
+	struct txq_entry_t *ctrl;
 	int ret = 0;
 	int counter;
 	int timeout;
+	int batch;
+	ktime_t start;
 	u32 vmm_table[WILC_VMM_TBL_SIZE];
-	u8 ac_pkt_num_to_chip[NQUEUES] = {0, 0, 0, 0};
+	u8 ac_pkt_num_to_chip[WILC_TXQ_NUM] = {0, 0, 0, 0, 0};
 	struct wilc_vif *vif;
 	struct wilc *wilc;
 	const struct wilc_hif_func *func;
@@ -990,6 +1296,7 @@ int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 
 	txb = wilc->tx_buffer;
 	wilc->txq_exit = 0;
+	wilc_wlan_txq_splice_staged(wilc);
 	if (!wilc->txq_entries) {
 		wilc->txq_exit = 1;
 		*txq_count = 0;
@@ -1002,67 +1309,57 @@ int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 		return -1;
 	
 	mutex_lock(&wilc->txq_add_to_head_cs);
+	wilc_wlan_ack_filter_update(wilc);
 	wilc_wlan_txq_filter_dup_tcp_ack(dev);
 
 	PRINT_INFO(vif->ndev, TX_DBG,"Getting the head of the TxQ\n");
-	for(ac = 0; ac < NQUEUES; ac++)
-		tqe_q[ac] = wilc_wlan_txq_get_first(wilc, ac);
 	i = 0;
 	sum = 0;
 	max_size_over = 0;
+
+	/* Config and management frames go ahead of all data */
+	ctrl = wilc_wlan_txq_get_first(wilc, WILC_CTRL_Q);
+	while (ctrl && !max_size_over) {
+		if (!wilc_wlan_vmm_add(vif, ctrl, WILC_CTRL_Q, vmm_table,
+				       vmm_entries_ac, &i, &sum))
+			max_size_over = 1;
+		else
+			ctrl = wilc_wlan_txq_get_next(wilc, ctrl);
+	}
+
+	for(ac = 0; ac < NQUEUES; ac++)
+		tqe_q[ac] = wilc_wlan_txq_drop_aged(wilc,
+				wilc_wlan_txq_get_first(wilc, ac));
 	num_pkts_to_add = ac_desired_ratio;
-	do {
+	while (!max_size_over) {
 		ac_exist = 0;
 		for(ac = 0; (ac < NQUEUES) && (!max_size_over); ac++) {
 			if (tqe_q[ac]) {
 				ac_exist = 1;
 				for(k = 0; (k < num_pkts_to_add[ac]) && (!max_size_over) && tqe_q[ac]; k++) {
-					if (i < (WILC_VMM_TBL_SIZE - 1)) {
-						if (tqe_q[ac]->type == WILC_CFG_PKT)
-							vmm_sz = ETH_CONFIG_PKT_HDR_OFFSET;
-						else if (tqe_q[ac]->type == WILC_NET_PKT)
-							vmm_sz = ETH_ETHERNET_HDR_OFFSET;
-						else
-							vmm_sz = HOST_HDR_OFFSET;
-
-						vmm_sz += tqe_q[ac]->buffer_size;
-						PRINT_INFO(vif->ndev, TX_DBG,"VMM Size before alignment = %d\n",vmm_sz);
-						if (vmm_sz & 0x3)
-							vmm_sz = (vmm_sz + 4) & ~0x3;
-
-						if ((sum + vmm_sz) > LINUX_TX_SIZE) {
-							max_size_over = 1;
-							break;
-						}
-						PRINT_INFO(vif->ndev, TX_DBG,"VMM Size AFTER alignment = %d\n",vmm_sz);
-						vmm_table[i] = vmm_sz / 4;
-						PRINT_INFO(vif->ndev, TX_DBG,"VMMTable entry size = %d\n",vmm_table[i]);
-						if (tqe_q[ac]->type == WILC_CFG_PKT) {
-							vmm_table[i] |= BIT(10);
-							PRINT_INFO(vif->ndev, TX_DBG,"VMMTable entry changed for CFG packet = %d\n",vmm_table[i]);
-						}
-						vmm_table[i] = cpu_to_le32(vmm_table[i]);
-						vmm_entries_ac[i] = ac;
-
-						i++;
-						sum += vmm_sz;
-						PRINT_INFO(vif->ndev, TX_DBG,"sum = %d\n",sum);
-						tqe_q[ac] = wilc_wlan_txq_get_next(wilc, tqe_q[ac]);
-					} else {
+					if (!wilc_wlan_vmm_add(vif, tqe_q[ac], ac,
+							       vmm_table,
+							       vmm_entries_ac,
+							       &i, &sum)) {
 						max_size_over = 1;
 						break;
 					}
+					tqe_q[ac] = wilc_wlan_txq_drop_aged(wilc,
+							wilc_wlan_txq_get_next(wilc, tqe_q[ac]));
 				}
 			}
 		}
+		if (!ac_exist)
+			break;
 		num_pkts_to_add = ac_preserve_ratio;
-	} while (!max_size_over && ac_exist);
+	}
 
 	if (i == 0) {
 		PRINT_INFO(vif->ndev, TX_DBG,"Nothing in TX-Q\n");
 		goto out;
 	} 
 	vmm_table[i] = 0x0;
+	batch = i;
 
 	acquire_bus(wilc, ACQUIRE_AND_WAKEUP, PWR_DEV_SRC_WIFI);
 	counter = 0;
@@ -1207,7 +1504,6 @@ int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 	}
 
 	release_bus(wilc, RELEASE_ALLOW_SLEEP, PWR_DEV_SRC_WIFI);
-	schedule();
 	offset = 0;
 	i = 0;
 	do {
@@ -1251,13 +1547,11 @@ int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 		       tqe->buffer, tqe->buffer_size);
 		offset += vmm_sz;
 		i++;
+		wilc->txq[tqe->q_num].sent++;
 		tqe->status = 1;
 		if (tqe->tx_complete_func)
 			tqe->tx_complete_func(tqe->priv,
 					      tqe->status);
-		if (tqe->tcp_pending_ack_idx != NOT_TCP_ACK &&
-		    tqe->tcp_pending_ack_idx < MAX_PENDING_ACKS)
-			pending_acks_info[tqe->tcp_pending_ack_idx].txqe = NULL;
 		kfree(tqe);
 	} while (--entries);
 	for(i = 0; i < NQUEUES; i++)
@@ -1271,13 +1565,16 @@ int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count)
 		goto out_release_bus;
 	}
 
+	start = ktime_get();
 	ret = func->hif_block_tx_ext(wilc, 0, txb, offset);
 	if(!ret)
 		PRINT_ER(vif->ndev, "fail block tx ext...\n");
+	wilc->tx_xfer_us = ktime_to_us(ktime_sub(ktime_get(), start));
+	if (ret && tx_autotune_us)
+		wilc_wlan_tx_autotune(wilc, batch);
 
 out_release_bus:
 	release_bus(wilc, RELEASE_ALLOW_SLEEP, PWR_DEV_SRC_WIFI);
-	schedule();
 
 out:
 	mutex_unlock(&wilc->txq_add_to_head_cs);
@@ -1290,6 +1587,76 @@ out:
 	return ret;
 }
 
+static void wilc_wlan_handle_cfg_msg(struct wilc *wilc, u8 *buff, u32 len)
+{
+	struct wilc_vif *vif = wilc->vif[0];
+	struct wilc_cfg_rsp rsp;
+
+	wilc_wlan_cfg_indicate_rx(wilc, buff, len, &rsp);
+	if (rsp.type == WILC_CFG_RSP) {
+		PRINT_INFO(vif->ndev, RX_DBG, "cfg_seq %d rsp.seq %d\n",
+			   wilc->cfg_seq_no, rsp.seq_no);
+		if (wilc->cfg_seq_no == rsp.seq_no)
+			complete(&wilc->cfg_event);
+	} else if (rsp.type == WILC_CFG_RSP_STATUS) {
+		wilc_mac_indicate(wilc, WILC_MAC_INDICATE_STATUS);
+	} else if (rsp.type == WILC_CFG_RSP_SCAN) {
+		wilc_mac_indicate(wilc, WILC_MAC_INDICATE_SCAN);
+	}
+}
+
+/* Config responses and firmware events ('R', 'I', 'N' and 'S') are handled
+ * in order on their own workqueue, so scan result bursts and config traffic
+ * don't hold up data delivery in the IRQ thread.
+ */
+static void wilc_wlan_rx_evt_work(struct work_struct *work)
+{
+	struct wilc *wilc = container_of(work, struct wilc, rx_evt_work);
+	struct sk_buff *skb;
+
+	while ((skb = skb_dequeue(&wilc->rx_evt_q))) {
+		wilc_wlan_handle_cfg_msg(wilc, skb->data, skb->len);
+		wilc->rx_evt_msgs++;
+		consume_skb(skb);
+	}
+}
+
+static void wilc_wlan_queue_cfg_msg(struct wilc *wilc, u8 *buff, u32 len)
+{
+	struct sk_buff *skb;
+
+	skb = alloc_skb(len, GFP_ATOMIC);
+	if (!skb) {
+		wilc->rx_evt_drops++;
+		PRINT_ER(wilc->vif[0]->ndev, "Can't queue firmware message\n");
+		return;
+	}
+	memcpy(skb_put(skb, len), buff, len);
+	skb_queue_tail(&wilc->rx_evt_q, skb);
+	queue_work(wilc->rx_evt_wq, &wilc->rx_evt_work);
+}
+
+int wilc_wlan_rx_evt_init(struct wilc *wilc)
+{
+	skb_queue_head_init(&wilc->rx_evt_q);
+	INIT_WORK(&wilc->rx_evt_work, wilc_wlan_rx_evt_work);
+	wilc->rx_evt_wq = alloc_ordered_workqueue("WILC_rx_evt", 0);
+	if (!wilc->rx_evt_wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void wilc_wlan_rx_evt_deinit(struct wilc *wilc)
+{
+	if (!wilc->rx_evt_wq)
+		return;
+
+	destroy_workqueue(wilc->rx_evt_wq);
+	wilc->rx_evt_wq = NULL;
+	skb_queue_purge(&wilc->rx_evt_q);
+}
+
 static void wilc_wlan_handle_rx_buff(struct wilc *wilc, u8 *buffer, int size)
 {
 	int offset = 0;
@@ -1334,28 +1701,9 @@ static void wilc_wlan_handle_rx_buff(struct wilc *wilc, u8 *buffer, int size)
 							   PKT_STATUS_NEW);
 				}
 			} else {
-				struct wilc_cfg_rsp rsp;
-
 				buff_ptr += pkt_offset;
-
-				wilc_wlan_cfg_indicate_rx(wilc, buff_ptr,
-							  pkt_len,
-							  &rsp);
-				if (rsp.type == WILC_CFG_RSP) {
-					PRINT_INFO(vif->ndev, RX_DBG, 
-						   "cfg_seq %d rsp.seq %d\n",
-						   wilc->cfg_seq_no,
-						   rsp.seq_no);
-					if (wilc->cfg_seq_no == rsp.seq_no)
-						complete(&wilc->cfg_event);
-				} else if (rsp.type == WILC_CFG_RSP_STATUS) {
-					wilc_mac_indicate(wilc,
-							  WILC_MAC_INDICATE_STATUS);
-
-				} else if (rsp.type == WILC_CFG_RSP_SCAN) {
-					wilc_mac_indicate(wilc,
-							  WILC_MAC_INDICATE_SCAN);
-				}
+				wilc_wlan_queue_cfg_msg(wilc, buff_ptr,
+							pkt_len);
 			}
 		}
 		offset += tp_len;
@@ -1364,15 +1712,19 @@ static void wilc_wlan_handle_rx_buff(struct wilc *wilc, u8 *buffer, int size)
 	} while (1);
 }
 
+/* Delivery phase of RX: parse the transfers read so far and release their
+ * part of the ring.
+ */
 static void wilc_wlan_handle_rxq(struct wilc *wilc)
 {
-	int size;
-	u8 *buffer;
-	struct rxq_entry_t *rqe;
+	struct wilc_rx_desc *d;
 	struct wilc_vif *vif = wilc->vif[0];
+	u32 tail = wilc->rx_tail;
 
-	wilc->rxq_exit = 0;
-
+	/* Queue the frames of every pending transfer first and run NAPI
+	 * once for all of them.
+	 */
+	wilc->rx_batch = true;
 	do {
 		if (wilc->quit) {
 			PRINT_INFO(vif->ndev, RX_DBG,
@@ -1380,25 +1732,28 @@ static void wilc_wlan_handle_rxq(struct wilc *wilc)
 			complete(&wilc->cfg_event);
 			break;
 		}
-		rqe = wilc_wlan_rxq_remove(wilc);
-		if (!rqe) {
+		if (tail == smp_load_acquire(&wilc->rx_head)) {
 			PRINT_INFO(vif->ndev, RX_DBG,
 				   "nothing in RX queue\n");
 			break;
 		}
 
-		buffer = rqe->buffer;
-		size = rqe->buffer_size;
+		d = &wilc->rx_desc[tail % WILC_RX_DESC_NUM];
 		PRINT_INFO(vif->ndev, RX_DBG,
 			   "rxQ entery Size = %d - Address = %p\n",
-			   size,buffer);
+			   d->size, d->buffer);
 
-		wilc_wlan_handle_rx_buff(wilc, buffer, size);
+		wilc->rx_deliver_page = d->page;
+		wilc_wlan_handle_rx_buff(wilc, d->buffer, d->size);
+		wilc->rx_deliver_page = NULL;
+		put_page(d->page);
 
-		kfree(rqe);
+		tail++;
+		smp_store_release(&wilc->rx_tail, tail);
 	} while (1);
+	wilc->rx_batch = false;
+	wilc_rx_flush(wilc);
 
-	wilc->rxq_exit = 1;
 	PRINT_INFO(vif->ndev, RX_DBG,"THREAD: Exiting RX thread \n");
 }
 
@@ -1407,14 +1762,134 @@ static void wilc_unknown_isr_ext(struct wilc *wilc)
 	wilc->hif_func->hif_clear_int_ext(wilc, 0);
 }
 
-static void wilc_wlan_handle_isr_ext(struct wilc *wilc, u32 int_status)
+/* The RX ring is a compound page so that received frames can be handed up
+ * as page fragments of it instead of being copied.
+ */
+static struct page *wilc_wlan_rx_ring_alloc(struct wilc *wilc, gfp_t gfp)
+{
+	return alloc_pages(gfp | __GFP_COMP | __GFP_NOWARN,
+			   get_order(wilc->rx_buf_size));
+}
+
+static void wilc_wlan_rx_ring_free(struct wilc *wilc)
+{
+	u32 tail;
+	int i;
+
+	for (tail = wilc->rx_tail; tail != wilc->rx_head; tail++)
+		put_page(wilc->rx_desc[tail % WILC_RX_DESC_NUM].page);
+	for (i = 0; i < WILC_RX_RINGS; i++) {
+		if (wilc->rx_rings[i])
+			put_page(wilc->rx_rings[i]);
+		wilc->rx_rings[i] = NULL;
+	}
+	if (wilc->rx_bounce)
+		put_page(wilc->rx_bounce);
+	wilc->rx_bounce = NULL;
+	wilc->rx_page = NULL;
+	wilc->rx_buffer = NULL;
+	wilc->rx_buffer_offset = 0;
+	wilc->rx_head = 0;
+	wilc->rx_tail = 0;
+}
+
+/* Undelivered transfers and frames handed up without copying hold
+ * references to their ring, so only a ring nothing refers to any more is
+ * written from the start again. Up to
+ * WILC_RX_RINGS of them are kept; with all of those held by the stack, or
+ * no memory for another, transfers go to the bounce ring, whose frames are
+ * copied, until one is free again.
+ */
+static bool wilc_wlan_rx_ring_next(struct wilc *wilc)
 {
+	struct page *page = wilc->rx_page;
+	int i;
+
+	if (page != wilc->rx_bounce && page_count(page) == 1)
+		goto reuse;
+
+	for (i = 0; i < WILC_RX_RINGS; i++) {
+		page = wilc->rx_rings[i];
+		if (page && page_count(page) == 1)
+			goto reuse;
+	}
+
+	for (i = 0; i < WILC_RX_RINGS; i++) {
+		if (wilc->rx_rings[i])
+			continue;
+		/* Don't stall the IRQ thread on reclaim for it */
+		page = wilc_wlan_rx_ring_alloc(wilc, GFP_KERNEL | __GFP_NORETRY);
+		if (!page) {
+			wilc->rx_ring_fail++;
+			break;
+		}
+		wilc->rx_rings[i] = page;
+		wilc->rx_ring_allocs++;
+		goto out;
+	}
+
+	page = wilc->rx_bounce;
+	if (page_count(page) != 1)
+		return false;
+	wilc->rx_bounced++;
+	goto out;
+reuse:
+	wilc->rx_ring_reused++;
+out:
+	wilc->rx_page = page;
+	wilc->rx_buffer = page_address(page);
+	return true;
+}
+
+/* Find room for a transfer of size bytes: after the last one in the
+ * current ring, or else at the start of the next ring nothing refers to.
+ * Returns the ring offset, or -1 when every ring is still in use and the
+ * transfer has to wait until the delivery phase catches up.
+ */
+static int wilc_wlan_rx_reserve(struct wilc *wilc, u32 size)
+{
+	u32 tail = smp_load_acquire(&wilc->rx_tail);
 	u32 offset = wilc->rx_buffer_offset;
+
+	if (size > wilc->rx_buf_size ||
+	    wilc->rx_head - tail >= WILC_RX_DESC_NUM)
+		return -1;
+
+	if (wilc->rx_buf_size - offset >= size)
+		return offset;
+
+	return wilc_wlan_rx_ring_next(wilc) ? 0 : -1;
+}
+
+/* Track how many ring bytes undelivered transfers hold and how much of the
+ * end of a ring goes unused when a transfer doesn't fit there.
+ */
+static void wilc_wlan_rx_ring_account(struct wilc *wilc, u32 offset, u32 size)
+{
+	u32 tail = smp_load_acquire(&wilc->rx_tail);
+	u32 used = size;
+
+	if (offset < wilc->rx_buffer_offset) {
+		wilc->rx_wraps++;
+		wilc->rx_tail_waste += wilc->rx_buf_size - wilc->rx_buffer_offset;
+	}
+
+	for (; tail != wilc->rx_head; tail++)
+		used += wilc->rx_desc[tail % WILC_RX_DESC_NUM].size;
+	wilc->rx_ring_hwm = max(wilc->rx_ring_hwm, used);
+}
+
+/* Bus phase of RX: read the transfer into the RX ring and queue it. Returns
+ * true when there is something for wilc_wlan_handle_rxq to deliver.
+ */
+static bool wilc_wlan_handle_isr_ext(struct wilc *wilc, u32 int_status)
+{
+	struct wilc_rx_desc *d;
 	u8 *buffer = NULL;
+	int offset;
 	u32 size;
 	u32 retries = 0;
 	int ret = 0;
-	struct rxq_entry_t *rqe;
 	struct wilc_vif *vif = wilc->vif[0];
 
 	size = (int_status & 0x7fff) << 2;
@@ -1428,15 +1903,17 @@ static void wilc_wlan_handle_isr_ext(struct wilc *wilc, u32 int_status)
 	}
 
 	if (size > 0) {
-		if (LINUX_RX_SIZE - offset < size)
-			offset = 0;
-
-		if (wilc->rx_buffer) {
+		offset = wilc_wlan_rx_reserve(wilc, size);
+		if (offset >= 0) {
 			buffer = &wilc->rx_buffer[offset];
 		} else {
-			PRINT_ER(vif->ndev,
-				 "Rx Buffer is NULL. drop the packets (%d)\n",
-				 size);
+			/* Leave it in the chip; the interrupt stays pending
+			 * and is serviced again once delivery frees a ring.
+			 */
+			wilc->rx_no_room++;
+			PRINT_WRN(vif->ndev, RX_DBG,
+				  "No room in Rx Buffer, leave the packets (%d)\n",
+				  size);
 			goto _end_;
 		}
 		wilc->hif_func->hif_clear_int_ext(wilc,
@@ -1447,41 +1924,97 @@ static void wilc_wlan_handle_isr_ext(struct wilc *wilc, u32 int_status)
 			PRINT_ER(vif->ndev, "fail block rx\n");
 _end_:
 		if (ret) {
-			offset += size;
-			wilc->rx_buffer_offset = offset;
-			rqe = kmalloc(sizeof(*rqe), GFP_KERNEL);
-			if (rqe) {
-				rqe->buffer = buffer;
-				rqe->buffer_size = size;
-				PRINT_INFO(vif->ndev, RX_DBG,
-					   "rxq entery Size= %d Address= %p\n",
-					   rqe->buffer_size, rqe->buffer);
-				wilc_wlan_rxq_add(wilc, rqe);
-			}
+			wilc_wlan_rx_ring_account(wilc, offset, size);
+			d = &wilc->rx_desc[wilc->rx_head % WILC_RX_DESC_NUM];
+			d->buffer = buffer;
+			d->size = size;
+			d->page = wilc->rx_page;
+			get_page(d->page);
+			wilc->rx_buffer_offset = offset + size;
+			wilc->rx_xfer_bytes += size;
+			PRINT_INFO(vif->ndev, RX_DBG,
+				   "rxq entery Size= %d Address= %p\n",
+				   d->size, d->buffer);
+			smp_store_release(&wilc->rx_head, wilc->rx_head + 1);
 		}
 	}
-	if (ret)
-		wilc_wlan_handle_rxq(wilc);
+
+	return ret;
 }
 
-void wilc_handle_isr(struct wilc *wilc)
+/* Service the chip's interrupt status, either on an interrupt or from a
+ * poll. Returns true when RX data was read.
+ */
+static bool wilc_wlan_service_int(struct wilc *wilc, bool poll)
 {
 	u32 int_status;
 	struct wilc_vif *vif = wilc->vif[0];
+	bool rx = false;
+	int budget = RX_DRAIN_BUDGET;
+	u64 burst = wilc->rx_xfer_bytes;
+	ktime_t start;
 
 	acquire_bus(wilc, ACQUIRE_AND_WAKEUP, PWR_DEV_SRC_WIFI);
+	start = ktime_get();
 	wilc->hif_func->hif_read_int(wilc, &int_status);
 
-	if (int_status & DATA_INT_EXT)
-		wilc_wlan_handle_isr_ext(wilc, int_status);
-
-	if (!(int_status & (ALL_INT_EXT))) {
+	if (!(int_status & (ALL_INT_EXT)) && !poll) {
 		PRINT_WRN(vif->ndev, TX_DBG, ">> UNKNOWN_INTERRUPT - 0x%08x\n",
 			  int_status);
 		wilc_unknown_isr_ext(wilc);
 	}
 
+	/* Read whatever else is already pending while the chip is awake
+	 * instead of taking another interrupt and wake handshake for it.
+	 */
+	while (int_status & DATA_INT_EXT) {
+		if (!wilc_wlan_handle_isr_ext(wilc, int_status))
+			break;
+		rx = true;
+		wilc->rx_transfers++;
+		if (--budget == 0) {
+			wilc->rx_drain_out++;
+			break;
+		}
+		wilc->hif_func->hif_read_int(wilc, &int_status);
+	}
+
 	release_bus(wilc, RELEASE_ALLOW_SLEEP, PWR_DEV_SRC_WIFI);
+	wilc->rx_bus_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	burst = wilc->rx_xfer_bytes - burst;
+	wilc->rx_burst_max = max_t(u32, wilc->rx_burst_max, burst);
+
+	/* Parse and deliver with the bus free for TX and config. The ring
+	 * can't be overwritten meanwhile since interrupts are handled one at
+	 * a time.
+	 */
+	if (rx) {
+		start = ktime_get();
+		wilc_wlan_handle_rxq(wilc);
+		wilc->rx_deliver_ns += ktime_to_ns(ktime_sub(ktime_get(),
+							     start));
+	}
+
+	return rx;
+}
+
+void wilc_handle_isr(struct wilc *wilc)
+{
+	wilc->rx_irqs++;
+	wilc_wlan_service_int(wilc, false);
+}
+
+/* Poll the interrupt status with the IRQ line masked. Returns false when
+ * there was nothing to read.
+ */
+bool wilc_poll_isr(struct wilc *wilc)
+{
+	wilc->irq_polls++;
+	if (wilc_wlan_service_int(wilc, true))
+		return true;
+
+	wilc->irq_polls_empty++;
+	return false;
 }
 
 int wilc_wlan_firmware_download(struct wilc *wilc, const u8 *buffer,
@@ -1730,7 +2263,6 @@ int wilc_wlan_stop(struct wilc *wilc)
 void wilc_wlan_cleanup(struct net_device *dev)
 {
 	struct txq_entry_t *tqe;
-	struct rxq_entry_t *rqe;
 	u8 ac;
 	struct wilc_vif *vif;
 	struct wilc *wilc;
@@ -1739,7 +2271,18 @@ void wilc_wlan_cleanup(struct net_device *dev)
 	wilc = vif->wilc;
 
 	wilc->quit = 1;
-	for (ac = 0; ac < NQUEUES; ac++) {
+	tqe = wilc_wlan_txq_take_staged(wilc);
+	while (tqe) {
+		struct txq_entry_t *next = tqe->next;
+
+		atomic_dec(&wilc->tx_staged);
+		if (tqe->tx_complete_func)
+			tqe->tx_complete_func(tqe->priv, 0);
+		kfree(tqe);
+		tqe = next;
+	}
+
+	for (ac = 0; ac < WILC_TXQ_NUM; ac++) {
 		do {
 			tqe = wilc_wlan_txq_remove_from_head(dev, ac);
 			if (!tqe)
@@ -1750,15 +2293,11 @@ void wilc_wlan_cleanup(struct net_device *dev)
 		} while (1);
 	}
 
-	do {
-		rqe = wilc_wlan_rxq_remove(wilc);
-		if (!rqe)
-			break;
-		kfree(rqe);
-	} while (1);
+	if (wilc->rx_evt_wq)
+		flush_workqueue(wilc->rx_evt_wq);
+	skb_queue_purge(&wilc->rx_evt_q);
 
-	kfree(wilc->rx_buffer);
-	wilc->rx_buffer = NULL;
+	wilc_wlan_rx_ring_free(wilc);
 	kfree(wilc->tx_buffer);
 	wilc->tx_buffer = NULL;
 }
@@ -2014,6 +2553,65 @@ u32 wilc_get_chipid(struct wilc *wilc, bool update)
 	return chipid;
 }
 
+/* The ring is a power-of-two run of pages; use all of it */
+static u32 wilc_wlan_rx_ring_size(u32 size)
+{
+	size = clamp_t(u32, size, LINUX_RX_SIZE_MIN, LINUX_RX_SIZE_MAX);
+	return PAGE_SIZE << get_order(size);
+}
+
+/* RX ring size for rx_buf_auto: room for twice the largest burst read in
+ * one interrupt, so the next one fits while it is being delivered. Every
+ * ring that may be allocated, bounce ring included, has to fit in 1/512
+ * of RAM, but a ring never gets smaller than LINUX_RX_SIZE_MIN.
+ */
+static u32 wilc_wlan_rx_auto_size(struct wilc *wilc)
+{
+	u64 budget;
+	u32 size;
+
+	size = wilc->rx_burst_max ? wilc->rx_burst_max * 2 : rx_buf_size;
+	size = wilc_wlan_rx_ring_size(size);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+	budget = (u64)totalram_pages() << PAGE_SHIFT;
+#else
+	budget = (u64)totalram_pages << PAGE_SHIFT;
+#endif
+	budget = div_u64(budget >> 9, WILC_RX_RINGS + 1);
+
+	while (size > budget && size / 2 >= LINUX_RX_SIZE_MIN)
+		size /= 2;
+	return size;
+}
+
+/* Take the sizes from the module parameters. Buffers left over from an
+ * earlier init are dropped when their size changed.
+ */
+static void wilc_wlan_apply_tunables(struct wilc *wilc)
+{
+	u32 tx = clamp_t(u32, tx_buf_size, LINUX_TX_SIZE_MIN, LINUX_TX_SIZE);
+	u32 rx = rx_buf_auto ? wilc_wlan_rx_auto_size(wilc) :
+			       wilc_wlan_rx_ring_size(rx_buf_size);
+
+	if (wilc->tx_buffer && wilc->tx_buf_size != tx) {
+		kfree(wilc->tx_buffer);
+		wilc->tx_buffer = NULL;
+	}
+	if (wilc->rx_page && wilc->rx_buf_size != rx)
+		wilc_wlan_rx_ring_free(wilc);
+	wilc->tx_buf_size = tx;
+	wilc->rx_buf_size = rx;
+
+	wilc->vmm_batch = clamp_t(u32, tx_vmm_batch, 1, WILC_VMM_TBL_SIZE - 1);
+	if (tx_autotune_us)
+		wilc->vmm_batch = max_t(u16, wilc->vmm_batch,
+					TX_AUTOTUNE_MIN_BATCH);
+
+	wilc->fc_upper = clamp_t(u32, fc_upper, NQUEUES, 4096);
+	wilc->fc_lower = clamp_t(u32, fc_lower, 1, wilc->fc_upper - 1);
+}
+
 int wilc_wlan_init(struct net_device *dev)
 {
 	int ret = 0;
@@ -2041,8 +2639,12 @@ int wilc_wlan_init(struct net_device *dev)
 		goto fail;
 	}
 
+	wilc_wlan_apply_tunables(wilc);
+	wilc_wlan_ack_filter_init(wilc);
+	wilc_wlan_txq_est_init(wilc);
+
 	if (!wilc->tx_buffer)
-		wilc->tx_buffer = kmalloc(LINUX_TX_SIZE, GFP_KERNEL);
+		wilc->tx_buffer = kmalloc(wilc->tx_buf_size, GFP_KERNEL);
 
 	if (!wilc->tx_buffer) {
 		ret = -ENOBUFS;
@@ -2050,8 +2652,15 @@ int wilc_wlan_init(struct net_device *dev)
 		goto fail;
 	}
 
-	if (!wilc->rx_buffer)
-		wilc->rx_buffer = kmalloc(LINUX_RX_SIZE, GFP_KERNEL);
+	if (!wilc->rx_page) {
+		wilc->rx_rings[0] = wilc_wlan_rx_ring_alloc(wilc, GFP_KERNEL);
+		wilc->rx_bounce = wilc_wlan_rx_ring_alloc(wilc, GFP_KERNEL);
+		if (wilc->rx_rings[0] && wilc->rx_bounce) {
+			wilc->rx_page = wilc->rx_rings[0];
+			wilc->rx_buffer = page_address(wilc->rx_page);
+		}
+		wilc->rx_buffer_offset = 0;
+	}
 	PRINT_D(vif->ndev, TX_DBG, "g_wlan.rx_buffer =%p\n", wilc->rx_buffer);
 	if (!wilc->rx_buffer) {
 		ret = -ENOBUFS;
@@ -2068,8 +2677,7 @@ int wilc_wlan_init(struct net_device *dev)
 
 fail:
 
-	kfree(wilc->rx_buffer);
-	wilc->rx_buffer = NULL;
+	wilc_wlan_rx_ring_free(wilc);
 	kfree(wilc->tx_buffer);
 	wilc->tx_buffer = NULL;
 
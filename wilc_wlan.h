@@ -3,6 +3,9 @@
 #define WILC_WLAN_H
 
 #include <linux/types.h>
+#include <linux/list.h>
+#include <linux/llist.h>
+#include <linux/spinlock.h>
 #include <linux/version.h>
 
 #define ISWILC1000(id)			((id & 0xfffff000) == 0x100000 ? 1 : 0)
@@ -135,6 +138,11 @@
 
 #define LINUX_RX_SIZE	(96 * 1024)
 #define LINUX_TX_SIZE	(64 * 1024)
+#define LINUX_RX_SIZE_MIN	(64 * 1024)
+#define LINUX_RX_SIZE_MAX	(256 * 1024)
+#define LINUX_TX_SIZE_MIN	(4 * 1024)
+#define WILC_RX_RINGS		3
+#define TX_AUTOTUNE_MIN_BATCH	4
 
 #define MODALIAS		"WILC_SPI"
 #define GPIO_NUM_IRQ		25
@@ -143,6 +151,9 @@
 
 
 #define NQUEUES			4
+/* Config and management frames get their own queue after the ACs */
+#define WILC_CTRL_Q		NQUEUES
+#define WILC_TXQ_NUM		(NQUEUES + 1)
 #define VO_AC_COUNT_POS		25
 #define VO_AC_ACM_STAT_POS	24
 #define VI_AC_COUNT_POS		17
@@ -151,7 +162,6 @@
 #define BE_AC_ACM_STAT_POS	8
 #define BK_AC_COUNT_POS		2
 #define BK_AC_ACM_STAT_POS	1
-#define AC_BUFFER_SIZE		1000
 /*******************************************/
 /*        E0 and later Interrupt flags.    */
 /*******************************************/
@@ -229,6 +239,28 @@ struct txq_handle {
 	struct txq_entry_t *txq_tail;
 	u16 count;
 	u8 acm;
+	u32 aged_out;
+	u32 bytes;
+	u32 sent;
+};
+
+#define TXQ_EST_WINDOW_MS	50
+#define TXQ_EST_WEIGHT		2
+#define TXQ_EST_FRAC		4
+#define TXQ_EST_MIN_BYTES	1600
+
+/* Per-AC arrival rates averaged over TXQ_EST_WINDOW_MS windows. Each AC's
+ * packet and byte limits are its share of the totals and are only
+ * recomputed when a window closes.
+ */
+struct wilc_txq_est {
+	unsigned long win_start;
+	u32 win_pkts[NQUEUES];
+	u32 win_bytes[NQUEUES];
+	u32 avg_pkts[NQUEUES];
+	u32 avg_bytes[NQUEUES];
+	u16 pkt_limit[NQUEUES];
+	u32 byte_limit[NQUEUES];
 };
 
 enum ip_pkt_priority {
@@ -243,18 +275,85 @@ struct txq_entry_t {
 	struct txq_entry_t *prev;
 	int type;
 	u8 q_num;
-	int tcp_pending_ack_idx;
+	struct tcp_ack_session *ack_session;
+	struct list_head ack_list;
+	u32 ack_num;
 	u8 *buffer;
 	int buffer_size;
 	void *priv;
 	int status;
+	unsigned long enq_time;
+	struct llist_node stage_node;
+	u16 l3_proto;
+	u16 nh_offset;
+	u16 th_offset;
+	u8 ip_proto;
 	void (*tx_complete_func)(void *priv, int status);
 };
 
-struct rxq_entry_t {
-	struct rxq_entry_t *next;
+/* wilc->txq_flags: set while the TX thread has queued work to look at */
+#define WILC_TXQ_WORK		0
+
+#define WILC_ACK_HASH_BITS	6
+#define WILC_ACK_HASH_SIZE	BIT(WILC_ACK_HASH_BITS)
+#define WILC_MAX_TCP_SESSION	128
+
+struct tcp_ack_key {
+	__be32 saddr[4];
+	__be32 daddr[4];
+	__be16 sport;
+	__be16 dport;
+	u32 l3_proto;
+};
+
+/* A TCP flow with ACKs waiting in the TX queues. Sessions live in a fixed
+ * per-device pool and return to it once their last pending ACK leaves.
+ */
+struct tcp_ack_session {
+	struct hlist_node node;
+	struct tcp_ack_key key;
+	u32 bigger_ack_num;
+	u32 pending;
+};
+
+enum ack_filter_mode {
+	ACK_FILTER_AUTO = 0,
+	ACK_FILTER_ON = 1,
+	ACK_FILTER_OFF = 2
+};
+
+struct wilc_ack_filter {
+	bool enabled;
+	/* load sampled over the current controller window */
+	unsigned long win_start;
+	u32 win_pkts;
+	u32 win_acks;
+	u32 win_peak;
+	/* outcome of the last evaluated window */
+	u32 last_ratio;
+	u32 last_peak;
+	u32 enables;
+	u32 disables;
+	struct hlist_head hash[WILC_ACK_HASH_SIZE];
+	struct hlist_head free;
+	struct tcp_ack_session session[WILC_MAX_TCP_SESSION];
+	struct list_head pending;
+	u32 sessions;
+	u32 dropped;
+	u32 untracked;
+};
+
+#define WILC_RX_DESC_NUM	16
+/* transfers read per interrupt before the chip may sleep again */
+#define RX_DRAIN_BUDGET		8
+
+/* An RX transfer held in an RX ring until it has been delivered. It holds
+ * a reference to the ring page so the ring isn't reused before then.
+ */
+struct wilc_rx_desc {
 	u8 *buffer;
-	int buffer_size;
+	u32 size;
+	struct page *page;
 };
 
 enum wilc_chip_type {
@@ -318,7 +417,11 @@ int wilc_wlan_stop(struct wilc *wilc);
 int wilc_wlan_txq_add_net_pkt(struct net_device *dev, void *priv, u8 *buffer,
 			      u32 buffer_size, wilc_tx_complete_func_t func);
 int wilc_wlan_handle_txq(struct net_device *dev, u32 *txq_count);
+void wilc_wlan_txq_kick(struct wilc *wilc);
 void wilc_handle_isr(struct wilc *wilc);
+bool wilc_poll_isr(struct wilc *wilc);
+int wilc_wlan_rx_evt_init(struct wilc *wilc);
+void wilc_wlan_rx_evt_deinit(struct wilc *wilc);
 void wilc_wlan_cleanup(struct net_device *dev);
 int wilc_wlan_cfg_set(struct wilc_vif *vif, int start, u16 wid, u8 *buffer,
 		      u32 buffer_size, int commit, u32 drv_handler);
@@ -329,7 +432,6 @@ int wilc_wlan_cfg_get_val(struct wilc_vif *vif, u16 wid, u8 *buffer,
 int wilc_wlan_txq_add_mgmt_pkt(struct net_device *dev, void *priv, u8 *buffer,
 			       u32 buffer_size, wilc_tx_complete_func_t func);
 
-void wilc_enable_tcp_ack_filter(bool value);
 int wilc_wlan_get_num_conn_ifcs(struct wilc *wilc);
 netdev_tx_t wilc_mac_xmit(struct sk_buff *skb, struct net_device *dev);
 